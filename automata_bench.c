@@ -0,0 +1,657 @@
+/* Benchmark driver for the C-- automata simulator: throughput (MB/s and
+   strings/s) and per-string latency percentiles for every matching engine,
+   over dense and sparse synthetic automata of varying state counts and input
+   lengths, plus parallel chunks on one large input and the result cache on
+   repeated tokens */
+
+#define AUTOMATA_NO_MAIN
+#include "automata_simulator.c"
+
+#define BENCH_SYMBOLS 16          /* random DFAs run over 'a'..'p' */
+#define BENCH_ROUNDS 3            /* batch kernels report their best round */
+#define BENCH_LEGACY_SECONDS 0.5  /* processString stops after this much time */
+#define BENCH_DEFAULT_MB 8
+#define BENCH_SPARSE_EXITS 2      /* sparse DFAs: random exits per state, on average */
+#define BENCH_VOCABULARY 4096     /* distinct tokens in the repeated-token corpus */
+#define BENCH_CACHE_ENTRIES 16384 /* result cache entries per shard */
+
+/* Bench Corpus: count strings of one length, back to back and NUL-terminated
+   so the legacy processString can read them too */
+typedef struct {
+    MatchInput *inputs;
+    char *buffer;
+    size_t count;
+    size_t bytes;
+} BenchCorpus;
+
+/* Bench Report: one engine's measurements over (a prefix of) a corpus */
+typedef struct {
+    const char *engine;
+    double seconds;   /* wall time for the strings covered */
+    size_t strings;   /* strings covered, less than the corpus for processString */
+    size_t bytes;
+    size_t accepted;
+    double *latency;  /* per-string seconds, NULL for batch kernels */
+} BenchReport;
+
+/* Batch Kernel: common shape of the batch matchers */
+typedef size_t (*BatchKernel)(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                              BatchResult *results);
+
+/* Bench Random: next value of the benchmark's reproducible LCG */
+static unsigned int benchRandom(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+/* Build Random DFA: complete DFA over BENCH_SYMBOLS symbols. On average exits
+   of each state's symbols go to uniformly random states, so larger state counts
+   defeat the cache; the rest lead back to state 0. */
+static int buildRandomDFA(FSM *fsm, int stateCount, int exits, unsigned int *seed) {
+    char name[16];
+    int i, k;
+
+    initializeFSM(fsm);
+    if (reserveFSM(fsm, stateCount, stateCount * BENCH_SYMBOLS) != 0) {
+        freeFSM(fsm);
+        return -1;
+    }
+    for (i = 0; i < stateCount; i++) {
+        sprintf(name, "r%d", i);
+        if (addState(fsm, name, benchRandom(seed) & 1) < 0) {
+            freeFSM(fsm);
+            return -1;
+        }
+    }
+    for (i = 0; i < stateCount; i++) {
+        for (k = 0; k < BENCH_SYMBOLS; k++) {
+            addTransition(fsm, i,
+                          benchRandom(seed) % BENCH_SYMBOLS < (unsigned int)exits ?
+                          (int)(benchRandom(seed) % (unsigned int)stateCount) : 0,
+                          (char)('a' + k));
+        }
+    }
+    fsm->initialState = 0;
+    return 0;
+}
+
+/* Make Corpus: about totalBytes of random strings of exactly length symbols */
+static int makeCorpus(BenchCorpus *corpus, size_t length, size_t totalBytes,
+                      unsigned int *seed) {
+    size_t i, j;
+    char *cursor;
+
+    corpus->count = totalBytes / length > 0 ? totalBytes / length : 1;
+    corpus->bytes = corpus->count * length;
+    corpus->inputs = malloc(corpus->count * sizeof(MatchInput));
+    corpus->buffer = malloc(corpus->count * (length + 1));
+    if (corpus->inputs == NULL || corpus->buffer == NULL) {
+        printf("Error: Out of memory for a %lu-byte corpus\n", (unsigned long)corpus->bytes);
+        free(corpus->inputs);
+        free(corpus->buffer);
+        return -1;
+    }
+
+    cursor = corpus->buffer;
+    for (i = 0; i < corpus->count; i++) {
+        corpus->inputs[i].data = cursor;
+        corpus->inputs[i].length = length;
+        for (j = 0; j < length; j++) {
+            *cursor++ = (char)('a' + benchRandom(seed) % BENCH_SYMBOLS);
+        }
+        *cursor++ = '\0';
+    }
+    return 0;
+}
+
+/* Free Corpus */
+static void freeCorpus(BenchCorpus *corpus) {
+    free(corpus->inputs);
+    free(corpus->buffer);
+    corpus->inputs = NULL;
+    corpus->buffer = NULL;
+}
+
+/* Compare Seconds: qsort order for latency samples */
+static int compareSeconds(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Percentile: p-quantile of sorted samples, nearest rank */
+static double percentile(const double *sorted, size_t count, double p) {
+    return sorted[(size_t)(p * (double)(count - 1) + 0.5)];
+}
+
+/* Print Report: one table row; latency columns only for per-string engines */
+static void printReport(BenchReport *report) {
+    printf("  %-16s %10.1f %12.0f", report->engine,
+           (double)report->bytes / report->seconds / 1e6,
+           (double)report->strings / report->seconds);
+    if (report->latency != NULL && report->strings > 0) {
+        qsort(report->latency, report->strings, sizeof(double), compareSeconds);
+        printf(" %10.0f %10.0f %10.0f",
+               percentile(report->latency, report->strings, 0.50) * 1e9,
+               percentile(report->latency, report->strings, 0.99) * 1e9,
+               percentile(report->latency, report->strings, 0.999) * 1e9);
+    } else {
+        printf(" %10s %10s %10s", "-", "-", "-");
+    }
+    printf("\n");
+}
+
+/* Bench Legacy: processString one string at a time, trace included, until
+   the corpus or BENCH_LEGACY_SECONDS runs out */
+static void benchLegacy(const FSM *fsm, const BenchCorpus *corpus, BenchReport *report) {
+    ProcessResult result;
+    double start, before, after;
+    size_t i;
+
+    report->engine = "processString";
+    report->accepted = 0;
+    start = benchSeconds();
+    after = start;
+    for (i = 0; i < corpus->count && after - start < BENCH_LEGACY_SECONDS; i++) {
+        before = benchSeconds();
+        result = processString(fsm, corpus->inputs[i].data);
+        report->accepted += (size_t)result.accepted;
+        freeProcessResult(&result);
+        after = benchSeconds();
+        report->latency[i] = after - before;
+    }
+    report->seconds = after - start;
+    report->strings = i;
+    report->bytes = i * corpus->inputs[0].length;
+}
+
+/* Bench Compiled: matchCompiledFSM one string at a time */
+static void benchCompiled(const CompiledFSM *cfsm, const BenchCorpus *corpus,
+                          BenchReport *report) {
+    double start, before, after;
+    size_t i;
+
+    report->engine = "compiled";
+    report->accepted = 0;
+    start = benchSeconds();
+    after = start;
+    for (i = 0; i < corpus->count; i++) {
+        before = benchSeconds();
+        report->accepted += (size_t)matchCompiledFSM(cfsm, corpus->inputs[i].data,
+                                                     corpus->inputs[i].length).accepted;
+        after = benchSeconds();
+        report->latency[i] = after - before;
+    }
+    report->seconds = after - start;
+    report->strings = corpus->count;
+    report->bytes = corpus->bytes;
+}
+
+/* Bench Packed: matchPackedFSM one string at a time */
+static void benchPacked(const PackedFSM *packed, const BenchCorpus *corpus,
+                        BenchReport *report) {
+    double start, before, after;
+    size_t i;
+
+    report->engine = "packed";
+    report->accepted = 0;
+    start = benchSeconds();
+    after = start;
+    for (i = 0; i < corpus->count; i++) {
+        before = benchSeconds();
+        report->accepted += (size_t)matchPackedFSM(packed, corpus->inputs[i].data,
+                                                   corpus->inputs[i].length).accepted;
+        after = benchSeconds();
+        report->latency[i] = after - before;
+    }
+    report->seconds = after - start;
+    report->strings = corpus->count;
+    report->bytes = corpus->bytes;
+}
+
+/* Parallel Kernel: matchBatchParallel on every online core */
+static size_t parallelKernel(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                             BatchResult *results) {
+    return matchBatchParallel(cfsm, inputs, count, results, 0);
+}
+
+/* Bench Batch: best of BENCH_ROUNDS calls of a whole-corpus batch kernel */
+static void benchBatch(const char *engine, BatchKernel kernel, const CompiledFSM *cfsm,
+                       const BenchCorpus *corpus, BatchResult *results, BenchReport *report) {
+    double elapsed;
+    int round;
+
+    report->engine = engine;
+    report->seconds = 1e30;
+    report->strings = corpus->count;
+    report->bytes = corpus->bytes;
+    report->latency = NULL;
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        elapsed = benchSeconds();
+        report->accepted = kernel(cfsm, corpus->inputs, corpus->count, results);
+        elapsed = benchSeconds() - elapsed;
+        report->seconds = elapsed < report->seconds ? elapsed : report->seconds;
+    }
+}
+
+/* Bench Automaton: every engine on one random DFA and one input length.
+   Returns 0, or -1 if the engines disagree on the accepted count. */
+static int benchAutomaton(const FSM *fsm, const CompiledFSM *cfsm, const PackedFSM *packed,
+                          size_t length, size_t totalBytes, unsigned int *seed) {
+    BenchCorpus corpus;
+    BenchReport report;
+    BatchResult *results;
+    double *latency;
+    size_t expected;
+    int status = 0;
+
+    if (makeCorpus(&corpus, length, totalBytes, seed) != 0) {
+        return -1;
+    }
+    results = malloc(corpus.count * sizeof(BatchResult));
+    latency = malloc(corpus.count * sizeof(double));
+    if (results == NULL || latency == NULL) {
+        printf("Error: Out of memory for benchmark results\n");
+        free(results);
+        free(latency);
+        freeCorpus(&corpus);
+        return -1;
+    }
+
+    printf("%d states (%d-byte entries, %d packed of %d cells), %lu-byte strings x %lu\n",
+           fsm->stateCount, cfsm->tableWidth, packed->entryCount,
+           cfsm->stateCount * cfsm->classCount, (unsigned long)length,
+           (unsigned long)corpus.count);
+    printf("  %-16s %10s %12s %10s %10s %10s\n", "engine", "MB/s", "strings/s", "p50 ns",
+           "p99 ns", "p99.9 ns");
+
+    report.latency = latency;
+    benchCompiled(cfsm, &corpus, &report);
+    expected = report.accepted;
+    printReport(&report);
+
+    benchPacked(packed, &corpus, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+
+    benchLegacy(fsm, &corpus, &report);
+    printReport(&report);
+
+    benchBatch("batch", matchBatch, cfsm, &corpus, results, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+    benchBatch("interleaved", matchBatchInterleaved, cfsm, &corpus, results, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+    benchBatch("parallel", parallelKernel, cfsm, &corpus, results, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+
+    if (status != 0) {
+        printf("Error: Engines disagree on the accepted count\n");
+    }
+    free(results);
+    free(latency);
+    freeCorpus(&corpus);
+    return status;
+}
+
+/* Ignore Span: searchAll callback for when only the match count is wanted */
+static void ignoreSpan(void *context, size_t start, size_t end) {
+    (void)context;
+    (void)start;
+    (void)end;
+}
+
+/* Make Log: totalBytes of synthetic log lines, one in 64 carrying an ERROR */
+static char *makeLog(size_t totalBytes, MatchInput **lines, size_t *lineCount,
+                     unsigned int *seed) {
+    static const char *const words[] = {"timeout", "refused", "overflow", "denied"};
+    char *log = malloc(totalBytes + 128);
+    size_t used = 0, count = 0, capacity = totalBytes / 32 + 1;
+    unsigned int r;
+    int n;
+
+    *lines = malloc(capacity * sizeof(MatchInput));
+    if (log == NULL || *lines == NULL) {
+        printf("Error: Out of memory for the search corpus\n");
+        free(log);
+        free(*lines);
+        return NULL;
+    }
+    while (used < totalBytes && count < capacity) {
+        r = benchRandom(seed);
+        if (r % 64 == 0) {
+            n = sprintf(log + used, "%02u:%02u:%02u ERROR upstream %s after %ums\n", r % 24,
+                        (r >> 5) % 60, (r >> 11) % 60, words[(r >> 17) % 4], r % 5000);
+        } else {
+            n = sprintf(log + used, "%02u:%02u:%02u INFO request served in %ums\n", r % 24,
+                        (r >> 5) % 60, (r >> 11) % 60, r % 900);
+        }
+        (*lines)[count].data = log + used;
+        (*lines)[count].length = (size_t)n - 1;
+        used += (size_t)n;
+        count++;
+    }
+    *lineCount = count;
+    return log;
+}
+
+/* Bench Search: searchAll over one log buffer, and searchFirst per line */
+static int benchSearch(const char *pattern, const char *log, size_t logLength,
+                       const MatchInput *lines, size_t lineCount) {
+    FSM nfa;
+    Searcher searcher;
+    BenchReport whole, report;
+    MatchSpan span;
+    double start, before, after;
+    size_t i, matches = 0;
+    int round;
+
+    if (compileRegex(pattern, &nfa) != 0) {
+        return -1;
+    }
+    if (compileSearcher(&nfa, &searcher, 10000) != 0) {
+        freeFSM(&nfa);
+        return -1;
+    }
+    freeFSM(&nfa);
+    report.latency = malloc(lineCount * sizeof(double));
+    if (report.latency == NULL) {
+        printf("Error: Out of memory for benchmark results\n");
+        freeSearcher(&searcher);
+        return -1;
+    }
+
+    printf("search '%s' (%d forward states, %s prefilter), %lu-byte log, %lu lines\n",
+           pattern, searcher.forward.stateCount,
+           searcher.prefilter.byteCount > 0 ? "with" : "no", (unsigned long)logLength,
+           (unsigned long)lineCount);
+    printf("  %-16s %10s %12s %10s %10s %10s\n", "engine", "MB/s", "strings/s", "p50 ns",
+           "p99 ns", "p99.9 ns");
+
+    whole.engine = "searchAll";
+    whole.seconds = 1e30;
+    whole.strings = 1;
+    whole.bytes = logLength;
+    whole.latency = NULL;
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        before = benchSeconds();
+        matches = searchAll(&searcher, log, logLength, SEARCH_LEFTMOST_LONGEST, ignoreSpan, NULL);
+        after = benchSeconds() - before;
+        whole.seconds = after < whole.seconds ? after : whole.seconds;
+    }
+    printReport(&whole);
+
+    report.engine = "searchFirst";
+    report.strings = lineCount;
+    report.bytes = logLength - lineCount;
+    report.accepted = 0;
+    start = benchSeconds();
+    after = start;
+    for (i = 0; i < lineCount; i++) {
+        before = benchSeconds();
+        report.accepted += (size_t)searchFirst(&searcher, lines[i].data, lines[i].length,
+                                               SEARCH_LEFTMOST_LONGEST, &span);
+        after = benchSeconds();
+        report.latency[i] = after - before;
+    }
+    report.seconds = after - start;
+    printReport(&report);
+    printf("  %lu matches, %lu matching lines\n", (unsigned long)matches,
+           (unsigned long)report.accepted);
+
+    free(report.latency);
+    freeSearcher(&searcher);
+    return 0;
+}
+
+/* Result cache behind cachedKernel and parallelCachedKernel, set by benchRepeated */
+static ResultCache benchCache;
+
+/* Cached Kernel: matchBatchCached through the first shard of benchCache */
+static size_t cachedKernel(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                           BatchResult *results) {
+    return matchBatchCached(cfsm, 1, &benchCache.shards[0], inputs, count, results);
+}
+
+/* Parallel Cached Kernel: matchBatchParallelCached, one thread per shard */
+static size_t parallelCachedKernel(const CompiledFSM *cfsm, const MatchInput *inputs,
+                                   size_t count, BatchResult *results) {
+    return matchBatchParallelCached(cfsm, 1, &benchCache, inputs, count, results);
+}
+
+/* Make Repeated Corpus: about totalBytes of 8..48-symbol tokens, each drawn
+   uniformly from BENCH_VOCABULARY distinct ones */
+static int makeRepeatedCorpus(BenchCorpus *corpus, size_t totalBytes, unsigned int *seed) {
+    MatchInput vocabulary[BENCH_VOCABULARY];
+    size_t i, j;
+    char *cursor;
+
+    corpus->count = totalBytes / 28 > 0 ? totalBytes / 28 : 1;
+    corpus->bytes = 0;
+    corpus->inputs = malloc(corpus->count * sizeof(MatchInput));
+    corpus->buffer = malloc((size_t)BENCH_VOCABULARY * 49);
+    if (corpus->inputs == NULL || corpus->buffer == NULL) {
+        printf("Error: Out of memory for the repeated-token corpus\n");
+        free(corpus->inputs);
+        free(corpus->buffer);
+        return -1;
+    }
+
+    cursor = corpus->buffer;
+    for (i = 0; i < BENCH_VOCABULARY; i++) {
+        vocabulary[i].data = cursor;
+        vocabulary[i].length = 8 + benchRandom(seed) % 41;
+        for (j = 0; j < vocabulary[i].length; j++) {
+            *cursor++ = (char)('a' + benchRandom(seed) % BENCH_SYMBOLS);
+        }
+        *cursor++ = '\0';
+    }
+    for (i = 0; i < corpus->count; i++) {
+        corpus->inputs[i] = vocabulary[benchRandom(seed) % BENCH_VOCABULARY];
+        corpus->bytes += corpus->inputs[i].length;
+    }
+    return 0;
+}
+
+/* Bench Repeated: uncached against cached batch matching on repeated tokens.
+   The cached kernels' best round runs with a warm cache. */
+static int benchRepeated(const CompiledFSM *cfsm, size_t totalBytes, unsigned int *seed) {
+    BenchCorpus corpus;
+    BenchReport report;
+    BatchResult *results;
+    ResultCacheStats stats;
+    size_t expected;
+    int status = 0;
+
+    if (makeRepeatedCorpus(&corpus, totalBytes, seed) != 0) {
+        return -1;
+    }
+    results = malloc(corpus.count * sizeof(BatchResult));
+    if (results == NULL || initResultCache(&benchCache, 0, BENCH_CACHE_ENTRIES) != 0) {
+        printf("Error: Out of memory for benchmark results\n");
+        free(results);
+        freeCorpus(&corpus);
+        return -1;
+    }
+
+    printf("%d compiled states, %lu tokens from %d distinct, %d-entry cache per shard\n",
+           cfsm->stateCount, (unsigned long)corpus.count, BENCH_VOCABULARY,
+           BENCH_CACHE_ENTRIES);
+    printf("  %-16s %10s %12s %10s %10s %10s\n", "engine", "MB/s", "strings/s", "p50 ns",
+           "p99 ns", "p99.9 ns");
+
+    benchBatch("batch", matchBatch, cfsm, &corpus, results, &report);
+    expected = report.accepted;
+    printReport(&report);
+    benchBatch("interleaved", matchBatchInterleaved, cfsm, &corpus, results, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+    benchBatch("cached", cachedKernel, cfsm, &corpus, results, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+    benchBatch("parallel cached", parallelCachedKernel, cfsm, &corpus, results, &report);
+    status |= report.accepted != expected ? -1 : 0;
+    printReport(&report);
+
+    resultCacheStats(&benchCache, &stats);
+    printf("  cache: %llu hits, %llu misses, %llu bypasses (%.1f%% hit rate)\n",
+           stats.hits, stats.misses, stats.bypasses,
+           100.0 * (double)stats.hits / (double)(stats.hits + stats.misses + stats.bypasses));
+    if (status != 0) {
+        printf("Error: Engines disagree on the accepted count\n");
+    }
+    freeResultCache(&benchCache);
+    free(results);
+    freeCorpus(&corpus);
+    return status;
+}
+
+/* Bench Chunked: one input of length bytes, matched by a single sequential walk
+   and by matchCompiledParallel on every online core; best of BENCH_ROUNDS each.
+   Returns 0, or -1 if they disagree. */
+static int benchChunked(const char *label, const CompiledFSM *cfsm, const char *input,
+                        size_t length) {
+    BenchReport sequential, parallel;
+    MatchResult expected, match;
+    double elapsed;
+    int round, status = 0;
+
+    printf("%s, %d compiled states, one %lu-byte input, %ld cores\n", label, cfsm->stateCount,
+           (unsigned long)length, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("  %-16s %10s %12s %10s %10s %10s\n", "engine", "MB/s", "strings/s", "p50 ns",
+           "p99 ns", "p99.9 ns");
+    sequential.engine = "sequential";
+    parallel.engine = "parallel chunks";
+    sequential.seconds = parallel.seconds = 1e30;
+    sequential.strings = parallel.strings = 1;
+    sequential.bytes = parallel.bytes = length;
+    sequential.latency = parallel.latency = NULL;
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        elapsed = benchSeconds();
+        expected = matchCompiledFSM(cfsm, input, length);
+        elapsed = benchSeconds() - elapsed;
+        sequential.seconds = elapsed < sequential.seconds ? elapsed : sequential.seconds;
+
+        elapsed = benchSeconds();
+        match = matchCompiledParallel(cfsm, input, length, 0);
+        elapsed = benchSeconds() - elapsed;
+        parallel.seconds = elapsed < parallel.seconds ? elapsed : parallel.seconds;
+        if (match.accepted != expected.accepted || match.failOffset != expected.failOffset) {
+            status = -1;
+        }
+    }
+    printReport(&sequential);
+    printReport(&parallel);
+    if (status != 0) {
+        printf("Error: Parallel chunks disagree with the sequential walk\n");
+    }
+    return status;
+}
+
+/* Main Program: automata_bench [MEGABYTES] of input per configuration */
+int main(int argc, char **argv) {
+    static const int stateCounts[] = {16, 256, 4096, 65536};
+    static const size_t lengths[] = {16, 256, 4096};
+    static const char *const patterns[] = {"ERROR [a-z]+", "[0-9]+ms", "(INFO|ERROR) [a-z]+"};
+    FSM fsm;
+    CompiledFSM cfsm;
+    PackedFSM packed;
+    MatchInput *lines;
+    size_t totalBytes, logLength, lineCount, l;
+    unsigned int seed = 12345;
+    char *log, *large;
+    long megabytes = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_MB;
+    int s, p, exits, status = 0;
+
+    if (megabytes <= 0) {
+        printf("Usage: %s [MEGABYTES]\n", argv[0]);
+        return 2;
+    }
+    totalBytes = (size_t)megabytes << 20;
+
+    for (exits = BENCH_SYMBOLS; exits > 0;
+         exits = exits == BENCH_SYMBOLS ? BENCH_SPARSE_EXITS : 0) {
+        printf("=== %s random DFAs ===\n\n", exits == BENCH_SYMBOLS ? "Dense" : "Sparse");
+        for (s = 0; s < (int)(sizeof(stateCounts) / sizeof(stateCounts[0])); s++) {
+            if (buildRandomDFA(&fsm, stateCounts[s], exits, &seed) != 0) {
+                return 2;
+            }
+            if (compileFSM(&fsm, &cfsm) != 0) {
+                freeFSM(&fsm);
+                return 2;
+            }
+            if (packCompiledFSM(&cfsm, &packed) != 0) {
+                freeCompiledFSM(&cfsm);
+                freeFSM(&fsm);
+                return 2;
+            }
+            for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+                status |= benchAutomaton(&fsm, &cfsm, &packed, lengths[l], totalBytes, &seed);
+                printf("\n");
+            }
+            freePackedFSM(&packed);
+            freeCompiledFSM(&cfsm);
+            freeFSM(&fsm);
+        }
+    }
+
+    printf("=== Single large input ===\n\n");
+    large = malloc(totalBytes * 4);
+    if (large == NULL) {
+        printf("Error: Out of memory for the large input\n");
+        return 2;
+    }
+    for (l = 0; l < totalBytes * 4; l++) {
+        large[l] = "abc"[l % 3];
+    }
+    createSampleFSM(&fsm);
+    status |= compileFSM(&fsm, &cfsm) != 0 ? -1 :
+              benchChunked("createSampleFSM (abc)*ab", &cfsm, large, totalBytes * 4 - 1);
+    printf("\n");
+    freeCompiledFSM(&cfsm);
+    freeFSM(&fsm);
+    for (l = 0; l < totalBytes * 4; l++) {
+        large[l] = (char)('a' + benchRandom(&seed) % BENCH_SYMBOLS);
+    }
+    for (s = 0; s < 2; s++) {
+        if (buildRandomDFA(&fsm, stateCounts[s], BENCH_SYMBOLS, &seed) != 0) {
+            free(large);
+            return 2;
+        }
+        status |= compileFSM(&fsm, &cfsm) != 0 ? -1 :
+                  benchChunked("dense random DFA", &cfsm, large, totalBytes * 4);
+        printf("\n");
+        freeCompiledFSM(&cfsm);
+        freeFSM(&fsm);
+    }
+    free(large);
+
+    printf("=== Repeated tokens ===\n\n");
+    if (buildRandomDFA(&fsm, stateCounts[sizeof(stateCounts) / sizeof(stateCounts[0]) - 1],
+                       BENCH_SYMBOLS, &seed) != 0) {
+        return 2;
+    }
+    if (compileFSM(&fsm, &cfsm) != 0) {
+        freeFSM(&fsm);
+        return 2;
+    }
+    status |= benchRepeated(&cfsm, totalBytes, &seed);
+    printf("\n");
+    freeCompiledFSM(&cfsm);
+    freeFSM(&fsm);
+
+    log = makeLog(totalBytes, &lines, &lineCount, &seed);
+    if (log == NULL) {
+        return 2;
+    }
+    logLength = (size_t)(lines[lineCount - 1].data - log) + lines[lineCount - 1].length + 1;
+    for (p = 0; p < (int)(sizeof(patterns) / sizeof(patterns[0])); p++) {
+        status |= benchSearch(patterns[p], log, logLength, lines, lineCount);
+        printf("\n");
+    }
+    free(lines);
+    free(log);
+    return status != 0 ? 1 : 0;
+}
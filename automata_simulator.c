@@ -3,18 +3,63 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-#define MAX_STATES 100
-#define MAX_TRANSITIONS 500
-#define MAX_ALPHABET 26
-#define MAX_TRACE 100
-#define MAX_NAME_LEN 50
+#define MAX_ALPHABET 256
 #define MAX_INPUT_LEN 1000
 
-/* State Structure */
+#define REGEX_MAX_DEPTH 256
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_STATES (1 << 22)
+
+#define SET_HAS(set, c) ((set)[(c) >> 3] & (1u << ((c) & 7)))
+#define SET_ADD(set, c) ((set)[(c) >> 3] |= (unsigned char)(1u << ((c) & 7)))
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK 512
+#define ARENA_MAX_BLOCK (1 << 20)
+
+/* Arena Block: header of one chained allocation block */
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+} ArenaBlock;
+
+/* Arena: bump allocator whose blocks are all released together */
+typedef struct {
+    ArenaBlock *head;
+    size_t blockSize; /* size of the next block, doubles up to ARENA_MAX_BLOCK */
+} Arena;
+
+/* String Pool: open-addressed set of names interned in the arena */
+typedef struct {
+    const char **slots;
+    int capacity; /* power of two */
+    int count;
+} StringPool;
+
+/* State Structure: hot per-state data; names live in FSM.stateNames */
 typedef struct {
-    char name[MAX_NAME_LEN];
     int isAccepting;
+    const int *matchIds;  /* sorted IDs of the patterns this state accepts (arena) */
+    int matchCount;
 } State;
 
 /* Transition Structure */
@@ -22,264 +67,6112 @@ typedef struct {
     int fromState;
     int toState;
     char symbol;
+    char isEpsilon; /* consumes no input; symbol is unused */
 } Transition;
 
-/* Finite State Machine Structure */
+/* Finite State Machine Structure: states, transitions and names live in the arena */
 typedef struct {
-    State states[MAX_STATES];
+    State *states;
+    const char **stateNames;       /* cold side table parallel to states, pool strings */
     int stateCount;
-    Transition transitions[MAX_TRANSITIONS];
+    int stateCapacity;
+    Transition *transitions;
     int transitionCount;
+    int transitionCapacity;
     int initialState;
-    int currentState;
     char alphabet[MAX_ALPHABET];
     int alphabetSize;
+    unsigned short byteClass[256]; /* byte -> alphabet index + 1, 0 = not in alphabet */
+    Arena arena;
+    StringPool names;
 } FSM;
 
-/* Trace Entry */
+/* FSM Cursor: per-run position, kept outside the FSM so the definition stays const */
+typedef struct {
+    int currentState;
+    long stepCount;
+} FSMCursor;
+
+/* Trace Event Kinds */
+typedef enum {
+    TRACE_START = 0,       /* toState is the initial state */
+    TRACE_STEP,            /* fromState --symbol--> toState */
+    TRACE_NOT_IN_ALPHABET, /* symbol rejected before any transition lookup */
+    TRACE_NO_TRANSITION,   /* fromState has no edge on symbol */
+    TRACE_ACCEPT,
+    TRACE_REJECT
+} TraceEventKind;
+
+/* Trace Event: fixed-size binary record, rendered to text only by printTrace */
 typedef struct {
-    char message[256];
-} TraceEntry;
+    unsigned int step;   /* input offset the event refers to */
+    int fromState;
+    int toState;
+    unsigned char symbol;
+    unsigned char kind;  /* TraceEventKind */
+} TraceEvent;
 
 /* Process Result */
 typedef struct {
     int accepted;
-    TraceEntry trace[MAX_TRACE];
+    TraceEvent *trace;   /* growable event buffer, released by freeProcessResult */
     int traceCount;
+    int traceCapacity;
+    const FSM *fsm;      /* automaton whose state names the events refer to */
 } ProcessResult;
 
+/* Match Result: verdict only, no trace */
+typedef struct {
+    int accepted;
+    int finalState;  /* FSM state where matching stopped */
+    long failOffset; /* offset of the rejected byte, -1 if all input was consumed */
+} MatchResult;
+
+/* Match Input: one (pointer, length) record for batch matching */
+typedef struct {
+    const char *data;
+    size_t length;
+} MatchInput;
+
+/* Batch Result: accepted bit plus failure offset packed into 32 bits */
+#define BATCH_NO_FAILURE 0x7FFFFFFFu
+
+typedef struct {
+    unsigned int accepted : 1;
+    unsigned int failOffset : 31; /* BATCH_NO_FAILURE if the whole input was consumed */
+} BatchResult;
+
+/* Interleaved batch kernel: independent inputs advanced together, and the
+   bytes each lane runs between checks for death or end of input */
+#define INTERLEAVE_LANES 8
+#define INTERLEAVE_BLOCK 64
+
+/* Compiled FSM: dense [state][symbol-class] next-state table.
+   A compiled state is identified by its row offset (index * classCount), which is
+   what the table stores, so a step is a single load. Index 0 is the dead state,
+   then the rejecting and finally the accepting FSM states, so a state accepts iff
+   its offset is >= acceptStart. FSM states that cannot reach acceptance are
+   folded into the dead state, so a run rejects as soon as its verdict is fixed.
+   Absorbing states (accepting, every byte loops back) come last, from
+   absorbStart up: once entered the input is accepted whatever follows. Entries
+   are 1, 2 or 4 bytes wide, the narrowest that holds the largest offset. */
+#define DEAD_STATE 0
+#define COMPILED_ACCEPTING(cfsm, state) ((state) >= (cfsm)->acceptStart)
+
+typedef struct {
+    void *table;                 /* stateCount * classCount entries of tableWidth bytes */
+    int tableWidth;
+    int *fsmStates;              /* cold: FSM state of each compiled index, -1 = dead */
+    int *matchStart;             /* stateCount + 1 offsets into matchIds by index, NULL if untagged */
+    int *matchIds;
+    unsigned char classMap[256]; /* byte -> symbol class, class 0 = not in alphabet
+                                    (unless every byte is in the alphabet) */
+    int classCount;
+    int stateCount;              /* includes the dead state */
+    int initialState;            /* row offset */
+    int acceptStart;             /* row offset of the first accepting state */
+    int absorbStart;             /* row offset of the first absorbing state,
+                                    stateCount * classCount if none */
+} CompiledFSM;
+
+/* Packed FSM: comb-compressed (row displacement) form of a compiled FSM for
+   large, sparse alphabets. Each state keeps a fallback, its most common target,
+   and only the cells that differ from it are stored, slotted into the gaps of
+   other states' rows in one shared entry array: cell (s, c) is
+   entries[rows[s].base + c].target if that entry's owner is s, else
+   rows[s].fallback. A state with no dominant target stores its whole row, so
+   every lookup stays O(1) whatever the density. States are numbered as in the
+   CompiledFSM it was packed from (0 = dead, accepting from acceptStart up). */
+typedef struct {
+    int owner;                   /* state whose row holds this entry, -1 = free */
+    int target;
+} PackedEntry;
+
+typedef struct {
+    int base;                    /* entry index of class 0 of this row */
+    int fallback;                /* target of every class without an entry */
+} PackedRow;
+
+typedef struct {
+    PackedRow *rows;             /* stateCount rows */
+    PackedEntry *entries;        /* entryCount entries, gaps included; every
+                                    base + class is in range */
+    int *fsmStates;              /* cold: FSM state of each index, -1 = dead */
+    unsigned char classMap[256];
+    int classCount;
+    int stateCount;
+    int entryCount;
+    int initialState;            /* state index */
+    int acceptStart;             /* index of the first accepting state */
+    int absorbStart;             /* index of the first absorbing state */
+} PackedFSM;
+
+#define PACK_MAX_TRIES 1024      /* free gaps a sparse row is tried at before appending */
+#define PACK_WINDOW 4096         /* ...all within this many entries of the end */
+
+/* Stream Matcher: incremental run of a compiled FSM over chunked input */
+#define STREAM_SETTLED 1 /* streamFeed: accepted whatever follows */
+
+typedef struct {
+    const CompiledFSM *cfsm;
+    int state;       /* last live compiled state */
+    long offset;     /* bytes fed so far */
+    long failOffset; /* offset of the rejected byte, -1 while still alive */
+} StreamMatcher;
+
+/* Mapped File: read-only memory mapping of an input file */
+typedef struct {
+    const char *data;
+    size_t length;
+} MappedFile;
+
+/* Automaton Header: start of the binary compiled-automaton format. Sections
+   follow at AUTOMATON_ALIGN-aligned offsets in native byte order, so a mapped
+   file is used in place: classMap (256 bytes), table, fsmStates and, for
+   tagged automata, matchStart and matchIds. */
+#define AUTOMATON_MAGIC "AUTOMATA"
+#define AUTOMATON_VERSION 2
+#define AUTOMATON_BYTE_ORDER 0x01020304u
+#define AUTOMATON_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    unsigned int byteOrder;      /* AUTOMATON_BYTE_ORDER as the writer stored it */
+    unsigned int version;
+    unsigned int tableWidth;
+    unsigned int classCount;
+    unsigned int stateCount;
+    unsigned int initialState;
+    unsigned int acceptStart;
+    unsigned int absorbStart;
+    unsigned int matchIdCount;   /* 0: no matchStart/matchIds sections */
+    unsigned long long classMapOffset;
+    unsigned long long tableOffset;
+    unsigned long long fsmStatesOffset;
+    unsigned long long matchStartOffset;
+    unsigned long long matchIdsOffset;
+    unsigned long long fileSize;
+} AutomatonHeader;
+
+/* Loaded Automaton: a compiled FSM whose arrays point into a mapped file.
+   Release with unloadCompiledFSM, never freeCompiledFSM. */
+typedef struct {
+    CompiledFSM cfsm;
+    MappedFile file;
+} LoadedAutomaton;
+
+/* Profiling (build with -DAUTOMATA_PROFILE): the compiled run loops count
+   every table cell they take. Counters are thread-local between profileAttach
+   and profileDetach, so the hot path adds one unshared increment per byte and
+   nothing at all when compiled out. */
+
+/* Profile Counts: recorded counts mapped back onto an FSM; always available,
+   so the counts can drive renumberFSM in any build */
+typedef struct {
+    unsigned long long *stateVisits;    /* per FSM state: bytes read in it */
+    unsigned long long *transitionHits; /* per FSM transition; symbols the compiler
+                                           merged into one byte class share a count */
+    unsigned long long deadExits;       /* in-alphabet bytes with no transition */
+    unsigned long long alphabetRejections;
+} ProfileCounts;
+
+/* State Heat: renumberFSM sort key */
+typedef struct {
+    unsigned long long visits;
+    int state;
+} StateHeat;
+
+#ifdef AUTOMATA_PROFILE
+typedef struct {
+    const CompiledFSM *cfsm;
+    unsigned long long *cellHits; /* per table cell: times that step was taken */
+    pthread_mutex_t lock;         /* guards cellHits while threads detach */
+} CompiledProfile;
+
+static _Thread_local CompiledProfile *profileTarget;
+static _Thread_local unsigned long long *profileHits;
+
+#define PROFILE_HIT(hits, cell)        \
+    do {                               \
+        if ((hits) != NULL) {          \
+            (hits)[cell]++;            \
+        }                              \
+    } while (0)
+#else
+#define PROFILE_HIT(hits, cell) ((void)0)
+#endif
+
+/* State Index: interned state name -> state number, used while loading a
+   text definition. Keys are pool pointers, so equal names are equal pointers. */
+typedef struct {
+    const char **keys;
+    int *values;
+    int capacity; /* power of two */
+    int count;
+} StateIndex;
+
+/* Line Match Callback: called for each accepted line of a mapped file */
+typedef void (*LineMatchCallback)(void *context, size_t lineNumber, size_t offset,
+                                  size_t length);
+
+/* Regex Node Types */
+typedef enum {
+    RX_EMPTY = 0,
+    RX_SET,      /* one byte from set */
+    RX_CONCAT,
+    RX_ALT,
+    RX_STAR,
+    RX_PLUS,
+    RX_QUEST,
+    RX_REPEAT    /* left{min,max}, max -1 = unbounded */
+} RegexNodeType;
+
+/* Regex Node: one node of the parsed pattern, children are node indices */
+typedef struct {
+    int type;
+    int left;
+    int right;
+    int min;
+    int max;
+    int height;            /* quantifiers nested in this node, at most REGEX_MAX_DEPTH */
+    unsigned char set[32]; /* RX_SET bitmap */
+} RegexNode;
+
+/* Regex Parser */
+typedef struct {
+    const char *pattern;
+    const char *pos;
+    RegexNode *nodes;
+    int nodeCount;
+    int nodeCapacity;
+    int depth;
+    const char *error;
+} RegexParser;
+
+/* NFA Edge Group: every symbol leading from one state to the same target */
+typedef struct {
+    int toState;
+    unsigned char symbols[32]; /* bitmap */
+} NFAEdgeGroup;
+
+/* NFA Program: an NFA's edges indexed by source state for simulation */
+typedef struct {
+    const FSM *nfa;
+    int *groupStart;     /* stateCount + 1 offsets into groups */
+    NFAEdgeGroup *groups;
+    int *epsilonStart;   /* stateCount + 1 offsets into epsilonTargets */
+    int *epsilonTargets;
+} NFAProgram;
+
+/* State Set Table: interned NFA state sets (bitsets) for subset construction */
+typedef struct {
+    int wordCount;            /* 64-bit words per set */
+    unsigned long long *sets; /* capacity * wordCount */
+    int count;
+    int capacity;
+    int growable;             /* 0: insert fails once capacity is reached */
+    int *slots;               /* open addressing, set index + 1, 0 = empty */
+    int slotCapacity;         /* power of two, at least 2 * capacity */
+} StateSetTable;
+
+/* Lazy DFA: subset construction on demand while matching, under a memory cap.
+   Mutable cache: use one LazyDFA per thread. */
+#define LAZY_UNKNOWN 0
+#define LAZY_DEAD 1          /* next[] entries >= 2 encode cached state + 2 */
+
+typedef struct {
+    const NFAProgram *program;
+    StateSetTable cache;
+    int *next;                      /* cache.capacity * classCount entries */
+    unsigned char *accepting;
+    unsigned char classMap[256];    /* byte -> NFA symbol class */
+    int classRep[256];              /* a representative byte per class */
+    int classCount;
+    unsigned long long *startSet;
+    unsigned long long *acceptMask;
+    unsigned long long *scratch;    /* two sets: target and the state kept across a flush */
+    int *stack;
+    int startState;                 /* -1 until interned (again after a flush) */
+    long flushCount;
+} LazyDFA;
+
+/* Minimize Stats: state counts before and after minimizeFSM */
+typedef struct {
+    int originalStates;
+    int reachableStates;  /* reachable from the initial state */
+    int liveStates;       /* reachable and able to reach an accepting state */
+    int minimizedStates;
+} MinimizeStats;
+
+/* Pattern Set: many regexes in one minimized DFA; accepting states list the
+   IDs (array indices) of every pattern they complete */
+typedef struct {
+    FSM dfa;
+    CompiledFSM compiled;
+    int patternCount;
+} PatternSet;
+
+/* Search Mode: which match span searchFirst/searchAll report */
+typedef enum {
+    SEARCH_EARLIEST = 0,    /* the match that ends first, at its leftmost start */
+    SEARCH_LEFTMOST_LONGEST /* the leftmost-starting match, extended as far as possible */
+} SearchMode;
+
+/* Match Span: a match at data[start .. end) */
+typedef struct {
+    size_t start;
+    size_t end;
+} MatchSpan;
+
+/* Match Span Callback: called for each match found by searchAll */
+typedef void (*MatchSpanCallback)(void *context, size_t start, size_t end);
+
+/* Searcher: unanchored forward DFA that finds where a match ends, plus an anchored
+   DFA of the reversed language that walks back from there to where it starts */
+#define SEARCH_RANK(key, s) ((int)(((key)[(s) >> 1] >> (((s) & 1) * 32)) & 0xFFFFFFFFu))
+#define SEARCH_SET_RANK(key, s, r) \
+    ((key)[(s) >> 1] |= (unsigned long long)(r) << (((s) & 1) * 32))
+
+/* Prefilter: what every match must start with, found by walking the automaton from
+   its start state, so the search can skip straight to possible start offsets */
+#define PREFILTER_MAX_BYTES 3
+#define PREFILTER_MAX_PREFIX 16
+
+typedef struct {
+    unsigned char bytes[PREFILTER_MAX_BYTES]; /* possible first bytes */
+    int byteCount;                            /* 0: any byte may start a match, no skipping */
+    unsigned char prefix[PREFILTER_MAX_PREFIX]; /* literal every match begins with */
+    int prefixLength;
+    int rareOffset;                           /* prefix byte to scan for, the least common */
+} Prefilter;
+
+typedef struct {
+    CompiledFSM forward;
+    CompiledFSM reverse;
+    Prefilter prefilter;
+} Searcher;
+
+/* Result Cache: bounded memo of batch verdicts for short, often repeated inputs,
+   keyed by a hash of the caller's automaton ID and the input. An entry keeps the
+   input bytes, so a hash collision never returns a wrong verdict; longer inputs
+   bypass the cache. Each shard is a RESULT_CACHE_WAYS-way set-associative table
+   with least-recently-used eviction and its own counters, owned by one thread
+   at a time, so lookups take no locks. matchBatchParallelCached gives worker i
+   shard i. */
+#define RESULT_CACHE_MAX_KEY 51  /* longest cached input; an entry fills 64 bytes */
+#define RESULT_CACHE_WAYS 4
+
+typedef struct {
+    unsigned int hash;           /* 0 = empty */
+    unsigned int automatonId;
+    BatchResult result;
+    unsigned char length;
+    unsigned char key[RESULT_CACHE_MAX_KEY];
+} ResultCacheEntry;
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;   /* matched, then stored */
+    unsigned long long bypasses; /* longer than RESULT_CACHE_MAX_KEY, matched uncached */
+} ResultCacheStats;
+
+typedef struct {
+    ResultCacheEntry *entries;   /* (setMask + 1) * RESULT_CACHE_WAYS, recent first per set */
+    size_t setMask;
+    ResultCacheStats stats;
+    char pad[64];                /* keep neighbouring shards' counters off one cache line */
+} ResultCacheShard;
+
+typedef struct {
+    ResultCacheShard *shards;
+    int shardCount;
+} ResultCache;
+
+/* Chunk Run: one chunk of a matchCompiledParallel input, matched from every
+   state it might start in. Lanes start in every state CHUNK_LOOKBACK bytes
+   before the chunk and are deduplicated byte by byte up to it, which leaves
+   only the states the real run can be in there. Across the chunk, lanes that
+   reach the same state are merged every CHUNK_MERGE_BLOCK bytes, so the chunk
+   costs little more than one walk once they converge. A chunk with more than
+   CHUNK_MAX_LANES lanes is left to the caller to run once its start is known. */
+#define CHUNK_LOOKBACK 64
+#define CHUNK_MERGE_BLOCK 256
+#define CHUNK_MAX_LANES 16
+#define CHUNK_MIN_BYTES (1 << 16) /* smallest chunk worth a thread */
+#define CHUNK_LIVE ((size_t)-1)
+
+typedef struct {
+    const CompiledFSM *cfsm;
+    const unsigned char *data;
+    size_t lookback;             /* lanes start here, in every state */
+    size_t begin, end;           /* the chunk proper */
+    int *laneOf;                 /* compiled index -> lane holding it at begin, -1 = none */
+    int *laneState;              /* per lane: state at end, or before the byte it died on */
+    size_t *laneFail;            /* per lane: offset of that byte, CHUNK_LIVE if none */
+    int *parent;                 /* per lane: lane it merged into, itself if none */
+    int gaveUp;                  /* too many lanes, or out of memory */
+    pthread_t thread;
+} ChunkRun;
+
+/* Batch Job: read-only description of one matchBatchParallel call */
+struct BatchWorker;
+
+typedef struct {
+    const CompiledFSM *cfsm;
+    const MatchInput *inputs;
+    BatchResult *results;
+    size_t count;
+    size_t chunkSize;             /* inputs per work item */
+    struct BatchWorker *workers;
+    int workerCount;
+    ResultCache *cache;           /* NULL: uncached; else worker i owns shard i */
+    unsigned int automatonId;
+#ifdef AUTOMATA_PROFILE
+    CompiledProfile *profile;     /* caller's attached profile, shared by the workers */
+#endif
+} BatchJob;
+
+/* Batch Worker: one thread's run state, kept apart from the shared automaton */
+typedef struct BatchWorker {
+    _Atomic unsigned long long range; /* owned chunks: low 32 bits next, high 32 bits end */
+    const BatchJob *job;
+    size_t acceptedCount;
+    int index;
+    pthread_t thread;
+    char pad[64];                     /* keep neighbouring ranges off one cache line */
+} BatchWorker;
+
+/* Match Server: precompiled automata loaded once and shared read-only by every
+   connection. Requests are lines "ID INPUT" naming an automaton by its 0-based
+   position on the command line; each gets one response line, in request order:
+   ACCEPT, REJECT (all input read, not accepting), REJECT N (no transition on
+   byte N) or ERROR reason. Clients may pipeline: every complete request in the
+   bytes read so far forms one batch, matched per automaton by one batch call,
+   and the batch's responses go back in a single write. */
+#define SERVE_BUFFER (1 << 20)   /* bytes read at a time; also the longest request */
+#define SERVE_LISTEN_BACKLOG 64
+#define SERVE_ACCEPT_BACKOFF_MS 100 /* wait before retrying accept when out of fds or memory */
+
+typedef struct {
+    const LoadedAutomaton *automata;
+    int automatonCount;
+    int threadCount;             /* per batch; 1 = interleaved kernel on the caller */
+} MatchServer;
+
+/* Serve Request: one parsed request line of the current batch */
+typedef struct {
+    int automaton;               /* -1 bad request, -2 unknown automaton, -3 too long */
+    MatchInput input;
+    BatchResult result;
+} ServeRequest;
+
+/* Serve Batch: per-stream scratch for matching a batch of requests */
+typedef struct {
+    MatchInput *inputs;          /* the batch's inputs, grouped by automaton */
+    BatchResult *results;        /* parallel to inputs */
+    size_t *slot;                /* request index -> its position in inputs */
+    size_t *start;               /* automatonCount + 1 group offsets */
+    size_t capacity;             /* requests inputs, results and slot hold */
+} ServeBatch;
+
 /* Function Prototypes */
+void *arenaAlloc(Arena *arena, size_t size);
+void arenaFree(Arena *arena);
 void initializeFSM(FSM *fsm);
+void freeFSM(FSM *fsm);
+int reserveFSM(FSM *fsm, int stateCapacity, int transitionCapacity);
+const char *internName(FSM *fsm, const char *name);
 int addState(FSM *fsm, const char *name, int isAccepting);
+int setStateMatchIds(FSM *fsm, int state, const int *ids, int count);
 void addTransition(FSM *fsm, int fromState, int toState, char symbol);
-int findTransition(FSM *fsm, int currentState, char symbol);
-void resetFSM(FSM *fsm);
-ProcessResult processString(FSM *fsm, const char *input);
-void visualizeFSM(FSM *fsm);
-int charInAlphabet(FSM *fsm, char c);
+void addEpsilonTransition(FSM *fsm, int fromState, int toState);
+int addCodePointTransition(FSM *fsm, int fromState, int toState, unsigned long low,
+                           unsigned long high);
+int findTransition(const FSM *fsm, int currentState, char symbol);
+void resetFSM(const FSM *fsm, FSMCursor *cursor);
+int stepFSM(const FSM *fsm, FSMCursor *cursor, char symbol);
+ProcessResult processString(const FSM *fsm, const char *input);
+MatchResult matchString(const FSM *fsm, const char *input, size_t length);
+void visualizeFSM(const FSM *fsm);
+int charInAlphabet(const FSM *fsm, char c);
 void addToAlphabet(FSM *fsm, char c);
 void createSampleFSM(FSM *fsm);
+int loadFSMText(const char *text, size_t length, FSM *fsm);
+int loadFSMFile(const char *path, FSM *fsm);
+int compileRegex(const char *pattern, FSM *nfa);
+int buildNFAProgram(const FSM *nfa, NFAProgram *program);
+void freeNFAProgram(NFAProgram *program);
+int runNFAProgram(const NFAProgram *program, const char *input, size_t length);
+int matchRegex(const char *pattern, const char *input);
+int determinizeNFA(const FSM *nfa, FSM *dfa, int maxStates);
+int initLazyDFA(LazyDFA *lazy, const NFAProgram *program, size_t memoryLimit);
+void freeLazyDFA(LazyDFA *lazy);
+int runLazyDFA(LazyDFA *lazy, const char *input, size_t length);
+int minimizeFSM(const FSM *dfa, FSM *minimized, MinimizeStats *stats);
+int buildPatternSet(const char *const *patterns, int count, PatternSet *set, int maxStates);
+void freePatternSet(PatternSet *set);
+int matchPatternSet(const PatternSet *set, const char *input, size_t length, const int **ids);
+int compileSearcher(const FSM *fsm, Searcher *searcher, int maxStates);
+void freeSearcher(Searcher *searcher);
+int searchFirst(const Searcher *searcher, const char *data, size_t length, SearchMode mode,
+                MatchSpan *span);
+size_t searchAll(const Searcher *searcher, const char *data, size_t length, SearchMode mode,
+                 MatchSpanCallback callback, void *context);
 void printTrace(ProcessResult *result);
+void freeProcessResult(ProcessResult *result);
+size_t writeTraceBinary(const ProcessResult *result, FILE *out);
+int compileFSM(const FSM *fsm, CompiledFSM *cfsm);
+void freeCompiledFSM(CompiledFSM *cfsm);
+int runCompiledFSM(const CompiledFSM *cfsm, const char *input, size_t length);
+MatchResult matchCompiledFSM(const CompiledFSM *cfsm, const char *input, size_t length);
+int matchCompiledIds(const CompiledFSM *cfsm, const char *input, size_t length,
+                     const int **ids);
+int packCompiledFSM(const CompiledFSM *cfsm, PackedFSM *packed);
+void freePackedFSM(PackedFSM *packed);
+int runPackedFSM(const PackedFSM *packed, const char *input, size_t length);
+MatchResult matchPackedFSM(const PackedFSM *packed, const char *input, size_t length);
+size_t matchBatch(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                  BatchResult *results);
+size_t matchBatchInterleaved(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                             BatchResult *results);
+size_t matchBatchParallel(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                          BatchResult *results, int threadCount);
+int initResultCache(ResultCache *cache, int shardCount, size_t entriesPerShard);
+void freeResultCache(ResultCache *cache);
+void resultCacheStats(const ResultCache *cache, ResultCacheStats *stats);
+size_t matchBatchCached(const CompiledFSM *cfsm, unsigned int automatonId,
+                        ResultCacheShard *shard, const MatchInput *inputs, size_t count,
+                        BatchResult *results);
+size_t matchBatchParallelCached(const CompiledFSM *cfsm, unsigned int automatonId,
+                                ResultCache *cache, const MatchInput *inputs, size_t count,
+                                BatchResult *results);
+MatchResult matchCompiledParallel(const CompiledFSM *cfsm, const char *input, size_t length,
+                                  int threadCount);
+void streamInit(StreamMatcher *stream, const CompiledFSM *cfsm);
+int streamFeed(StreamMatcher *stream, const char *chunk, size_t length);
+int streamIsAccepting(const StreamMatcher *stream);
+MatchResult streamFinish(const StreamMatcher *stream);
+int mapFile(const char *path, MappedFile *file);
+void unmapFile(MappedFile *file);
+MatchResult matchMappedFile(const CompiledFSM *cfsm, const MappedFile *file);
+size_t matchMappedLines(const CompiledFSM *cfsm, const MappedFile *file,
+                        LineMatchCallback onMatch, void *context);
+int saveCompiledFSM(const CompiledFSM *cfsm, const char *path);
+int loadCompiledFSM(const char *path, LoadedAutomaton *loaded);
+void unloadCompiledFSM(LoadedAutomaton *loaded);
+int emitFSMSource(const FSM *dfa, const char *name, FILE *out);
+int loadServer(MatchServer *server, char **paths, int count, int threadCount);
+void freeServer(MatchServer *server);
+int serveStream(const MatchServer *server, int inFd, int outFd);
+#ifdef AUTOMATA_PROFILE
+int initProfile(CompiledProfile *profile, const CompiledFSM *cfsm);
+void freeProfile(CompiledProfile *profile);
+int profileAttach(CompiledProfile *profile);
+void profileDetach(void);
+int profileCounts(const CompiledProfile *profile, const FSM *fsm, ProfileCounts *counts);
+#endif
+void freeProfileCounts(ProfileCounts *counts);
+void visualizeFSMProfile(const FSM *fsm, const ProfileCounts *counts);
+int renumberFSM(const FSM *fsm, const ProfileCounts *counts, FSM *reordered);
+
+#define ARENA_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* Arena Alloc: bump-allocate from the head block, chaining a new one when full */
+void *arenaAlloc(Arena *arena, size_t size) {
+    ArenaBlock *block = arena->head;
+    size_t need = ARENA_ROUND(size);
+    size_t blockSize;
+    void *ptr;
+
+    if (block == NULL || block->size - block->used < need) {
+        blockSize = arena->blockSize > need ? arena->blockSize : need;
+        block = malloc(ARENA_HEADER + blockSize);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->head;
+        block->used = 0;
+        block->size = blockSize;
+        arena->head = block;
+        if (arena->blockSize < ARENA_MAX_BLOCK) {
+            arena->blockSize *= 2;
+        }
+    }
+
+    ptr = (char *)block + ARENA_HEADER + block->used;
+    block->used += need;
+    return ptr;
+}
+
+/* Arena Grow: extend the most recent allocation in place, or copy it */
+static void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize) {
+    ArenaBlock *block = arena->head;
+    void *grown;
+
+    if (ptr != NULL && block != NULL &&
+        (char *)ptr + ARENA_ROUND(oldSize) == (char *)block + ARENA_HEADER + block->used &&
+        block->size - block->used >= ARENA_ROUND(newSize) - ARENA_ROUND(oldSize)) {
+        block->used += ARENA_ROUND(newSize) - ARENA_ROUND(oldSize);
+        return ptr;
+    }
 
-/* Initialize FSM */
+    grown = arenaAlloc(arena, newSize);
+    if (grown != NULL && ptr != NULL) {
+        memcpy(grown, ptr, oldSize);
+    }
+    return grown;
+}
+
+/* Arena Free: release every block at once */
+void arenaFree(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    ArenaBlock *next;
+
+    while (block != NULL) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->blockSize = ARENA_MIN_BLOCK;
+}
+
+/* Initialize FSM (call freeFSM before re-initializing a used FSM) */
 void initializeFSM(FSM *fsm) {
+    fsm->states = NULL;
+    fsm->stateNames = NULL;
     fsm->stateCount = 0;
+    fsm->stateCapacity = 0;
+    fsm->transitions = NULL;
     fsm->transitionCount = 0;
+    fsm->transitionCapacity = 0;
     fsm->initialState = 0;
-    fsm->currentState = 0;
     fsm->alphabetSize = 0;
+    memset(fsm->byteClass, 0, sizeof(fsm->byteClass));
+    fsm->arena.head = NULL;
+    fsm->arena.blockSize = ARENA_MIN_BLOCK;
+    fsm->names.slots = NULL;
+    fsm->names.capacity = 0;
+    fsm->names.count = 0;
+}
+
+/* Free FSM: states, transitions and names go with the arena */
+void freeFSM(FSM *fsm) {
+    arenaFree(&fsm->arena);
+    initializeFSM(fsm);
+}
+
+/* Reserve FSM storage up front so large builds grow without copying */
+int reserveFSM(FSM *fsm, int stateCapacity, int transitionCapacity) {
+    State *states;
+    const char **names;
+    Transition *transitions;
+
+    if (stateCapacity > fsm->stateCapacity) {
+        states = arenaGrow(&fsm->arena, fsm->states,
+                           (size_t)fsm->stateCapacity * sizeof(State),
+                           (size_t)stateCapacity * sizeof(State));
+        if (states != NULL) {
+            fsm->states = states;
+        }
+        names = arenaGrow(&fsm->arena, fsm->stateNames,
+                          (size_t)fsm->stateCapacity * sizeof(const char *),
+                          (size_t)stateCapacity * sizeof(const char *));
+        if (states == NULL || names == NULL) {
+            printf("Error: Out of memory growing states\n");
+            return -1;
+        }
+        fsm->stateNames = names;
+        fsm->stateCapacity = stateCapacity;
+    }
+
+    if (transitionCapacity > fsm->transitionCapacity) {
+        transitions = arenaGrow(&fsm->arena, fsm->transitions,
+                                (size_t)fsm->transitionCapacity * sizeof(Transition),
+                                (size_t)transitionCapacity * sizeof(Transition));
+        if (transitions == NULL) {
+            printf("Error: Out of memory growing transitions\n");
+            return -1;
+        }
+        fsm->transitions = transitions;
+        fsm->transitionCapacity = transitionCapacity;
+    }
+
+    return 0;
+}
+
+/* Hash Name (FNV-1a) */
+static unsigned int hashName(const char *name) {
+    unsigned int hash = 2166136261u;
+
+    while (*name) {
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    }
+    return hash;
+}
+
+/* Intern Name: return the pool's copy of name, adding it if new */
+const char *internName(FSM *fsm, const char *name) {
+    StringPool *pool = &fsm->names;
+    const char **slots;
+    char *copy;
+    size_t length;
+    int i, capacity, mask;
+
+    /* Keep the load factor under one half */
+    if ((pool->count + 1) * 2 > pool->capacity) {
+        capacity = pool->capacity > 0 ? pool->capacity * 2 : 16;
+        slots = arenaAlloc(&fsm->arena, (size_t)capacity * sizeof(const char *));
+        if (slots == NULL) {
+            return NULL;
+        }
+        memset(slots, 0, (size_t)capacity * sizeof(const char *));
+        for (i = 0; i < pool->capacity; i++) {
+            if (pool->slots[i] != NULL) {
+                mask = (int)(hashName(pool->slots[i]) & (unsigned int)(capacity - 1));
+                while (slots[mask] != NULL) {
+                    mask = (mask + 1) & (capacity - 1);
+                }
+                slots[mask] = pool->slots[i];
+            }
+        }
+        pool->slots = slots;
+        pool->capacity = capacity;
+    }
+
+    i = (int)(hashName(name) & (unsigned int)(pool->capacity - 1));
+    while (pool->slots[i] != NULL) {
+        if (strcmp(pool->slots[i], name) == 0) {
+            return pool->slots[i];
+        }
+        i = (i + 1) & (pool->capacity - 1);
+    }
+
+    length = strlen(name) + 1;
+    copy = arenaAlloc(&fsm->arena, length);
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, name, length);
+    pool->slots[i] = copy;
+    pool->count++;
+    return copy;
 }
 
 /* Add State */
 int addState(FSM *fsm, const char *name, int isAccepting) {
-    if (fsm->stateCount >= MAX_STATES) {
-        printf("Error: Maximum number of states reached\n");
+    const char *interned;
+
+    if (fsm->stateCount == fsm->stateCapacity &&
+        reserveFSM(fsm, fsm->stateCapacity > 0 ? fsm->stateCapacity * 2 : 4,
+                   fsm->transitionCapacity) != 0) {
+        return -1;
+    }
+
+    interned = internName(fsm, name);
+    if (interned == NULL) {
+        printf("Error: Out of memory interning state name\n");
         return -1;
     }
 
-    strncpy(fsm->states[fsm->stateCount].name, name, MAX_NAME_LEN - 1);
-    fsm->states[fsm->stateCount].name[MAX_NAME_LEN - 1] = '\0';
+    fsm->stateNames[fsm->stateCount] = interned;
     fsm->states[fsm->stateCount].isAccepting = isAccepting;
+    fsm->states[fsm->stateCount].matchIds = NULL;
+    fsm->states[fsm->stateCount].matchCount = 0;
     
     return fsm->stateCount++;
 }
 
-/* Check if character is in alphabet */
-int charInAlphabet(FSM *fsm, char c) {
-    int i;
-    for (i = 0; i < fsm->alphabetSize; i++) {
-        if (fsm->alphabet[i] == c) {
-            return 1;
+/* Set State Match IDs: tag a state with the (sorted) pattern IDs it accepts */
+int setStateMatchIds(FSM *fsm, int state, const int *ids, int count) {
+    int *copy = NULL;
+
+    if (count > 0) {
+        copy = arenaAlloc(&fsm->arena, (size_t)count * sizeof(int));
+        if (copy == NULL) {
+            printf("Error: Out of memory tagging state\n");
+            return -1;
         }
+        memcpy(copy, ids, (size_t)count * sizeof(int));
+        fsm->states[state].isAccepting = 1;
     }
+    fsm->states[state].matchIds = copy;
+    fsm->states[state].matchCount = count;
     return 0;
 }
 
+/* Check if character is in alphabet */
+int charInAlphabet(const FSM *fsm, char c) {
+    return fsm->byteClass[(unsigned char)c] != 0;
+}
+
 /* Add character to alphabet */
 void addToAlphabet(FSM *fsm, char c) {
     if (!charInAlphabet(fsm, c) && fsm->alphabetSize < MAX_ALPHABET) {
         fsm->alphabet[fsm->alphabetSize++] = c;
+        fsm->byteClass[(unsigned char)c] = (unsigned short)fsm->alphabetSize;
     }
 }
 
 /* Add Transition */
 void addTransition(FSM *fsm, int fromState, int toState, char symbol) {
-    if (fsm->transitionCount >= MAX_TRANSITIONS) {
-        printf("Error: Maximum number of transitions reached\n");
+    if (fsm->transitionCount == fsm->transitionCapacity &&
+        reserveFSM(fsm, fsm->stateCapacity,
+                   fsm->transitionCapacity > 0 ? fsm->transitionCapacity * 2 : 8) != 0) {
         return;
     }
 
     fsm->transitions[fsm->transitionCount].fromState = fromState;
     fsm->transitions[fsm->transitionCount].toState = toState;
     fsm->transitions[fsm->transitionCount].symbol = symbol;
+    fsm->transitions[fsm->transitionCount].isEpsilon = 0;
     fsm->transitionCount++;
     
     addToAlphabet(fsm, symbol);
 }
 
+/* Add Epsilon Transition (NFA only: compile or determinize before table matching) */
+void addEpsilonTransition(FSM *fsm, int fromState, int toState) {
+    if (fsm->transitionCount == fsm->transitionCapacity &&
+        reserveFSM(fsm, fsm->stateCapacity,
+                   fsm->transitionCapacity > 0 ? fsm->transitionCapacity * 2 : 8) != 0) {
+        return;
+    }
+
+    fsm->transitions[fsm->transitionCount].fromState = fromState;
+    fsm->transitions[fsm->transitionCount].toState = toState;
+    fsm->transitions[fsm->transitionCount].symbol = 0;
+    fsm->transitions[fsm->transitionCount].isEpsilon = 1;
+    fsm->transitionCount++;
+}
+
+/* UTF-8 Encode: write code point cp to out, returning its length in bytes */
+static int utf8Encode(unsigned long cp, unsigned char *out) {
+    if (cp < 0x80) {
+        out[0] = (unsigned char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (unsigned char)(0xC0 | (cp >> 6));
+        out[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (unsigned char)(0xE0 | (cp >> 12));
+        out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (unsigned char)(0xF0 | (cp >> 18));
+    out[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (unsigned char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/* Add UTF-8 Range: from -> to over [low, high], which share an encoded length.
+   The range is split until each piece's encodings are exactly the product of
+   one byte range per position; each piece becomes a chain of byte transitions
+   through fresh states. */
+static int addUtf8Range(FSM *fsm, int from, int to, unsigned long low, unsigned long high) {
+    unsigned char lowBytes[4], highBytes[4];
+    unsigned long mask;
+    char name[24];
+    int i, b, length, state, next;
+
+    for (i = 1; i < 4; i++) {
+        mask = (1UL << (6 * i)) - 1;
+        if ((low & ~mask) == (high & ~mask)) {
+            continue;
+        }
+        if ((low & mask) != 0) {
+            return addUtf8Range(fsm, from, to, low, low | mask) != 0 ? -1 :
+                   addUtf8Range(fsm, from, to, (low | mask) + 1, high);
+        }
+        if ((high & mask) != mask) {
+            return addUtf8Range(fsm, from, to, low, (high & ~mask) - 1) != 0 ? -1 :
+                   addUtf8Range(fsm, from, to, high & ~mask, high);
+        }
+    }
+
+    length = utf8Encode(low, lowBytes);
+    utf8Encode(high, highBytes);
+    for (i = 0, state = from; i < length; i++, state = next) {
+        next = to;
+        if (i < length - 1) {
+            sprintf(name, "u8.%d", fsm->stateCount);
+            if ((next = addState(fsm, name, 0)) < 0) {
+                return -1;
+            }
+        }
+        for (b = lowBytes[i]; b <= highBytes[i]; b++) {
+            addTransition(fsm, state, next, (char)b);
+        }
+    }
+    return 0;
+}
+
+/* Add Code Point Transition: from -> to on every code point in [low, high],
+   as byte transitions over their UTF-8 encodings (surrogates excluded), so
+   matching stays a byte-table lookup. Ranges from one state that share a lead
+   byte leave an NFA: determinize before table matching. Returns 0, or -1 for
+   a range outside U+0000..U+10FFFF. */
+int addCodePointTransition(FSM *fsm, int fromState, int toState, unsigned long low,
+                           unsigned long high) {
+    static const unsigned long lengthEnd[] = {0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
+    unsigned long first, last;
+    int i;
+
+    if (low > high || high > 0x10FFFF) {
+        printf("Error: Bad code point range U+%04lX-U+%04lX\n", low, high);
+        return -1;
+    }
+    for (i = 0, first = low; i < 4 && first <= high; i++) {
+        if (first > lengthEnd[i]) {
+            continue;
+        }
+        last = high < lengthEnd[i] ? high : lengthEnd[i];
+        /* Surrogates split the three-byte range */
+        if (first <= 0xDFFF && last >= 0xD800) {
+            if (first < 0xD800 && addUtf8Range(fsm, fromState, toState, first, 0xD7FF) != 0) {
+                return -1;
+            }
+            first = last > 0xDFFF ? 0xE000 : last + 1;
+        }
+        if (first <= last && addUtf8Range(fsm, fromState, toState, first, last) != 0) {
+            return -1;
+        }
+        first = last + 1;
+    }
+    return 0;
+}
+
 /* Find Transition */
-int findTransition(FSM *fsm, int currentState, char symbol) {
+int findTransition(const FSM *fsm, int currentState, char symbol) {
     int i;
     for (i = 0; i < fsm->transitionCount; i++) {
         if (fsm->transitions[i].fromState == currentState && 
-            fsm->transitions[i].symbol == symbol) {
+            fsm->transitions[i].symbol == symbol &&
+            !fsm->transitions[i].isEpsilon) {
             return i;
         }
     }
     return -1;
 }
 
-/* Reset FSM */
-void resetFSM(FSM *fsm) {
-    fsm->currentState = fsm->initialState;
+/* Reset FSM: rewind a cursor to the initial state */
+void resetFSM(const FSM *fsm, FSMCursor *cursor) {
+    cursor->currentState = fsm->initialState;
+    cursor->stepCount = 0;
+}
+
+/* Step FSM: advance a cursor by one symbol.
+   Returns the transition taken, or -1 (cursor unchanged) if there is none. */
+int stepFSM(const FSM *fsm, FSMCursor *cursor, char symbol) {
+    int transIndex;
+
+    if (!charInAlphabet(fsm, symbol)) {
+        return -1;
+    }
+    transIndex = findTransition(fsm, cursor->currentState, symbol);
+    if (transIndex >= 0) {
+        cursor->currentState = fsm->transitions[transIndex].toState;
+        cursor->stepCount++;
+    }
+    return transIndex;
+}
+
+/* Append Trace Event, doubling the buffer as needed */
+static void addTraceEvent(ProcessResult *result, TraceEventKind kind, size_t step,
+                          int fromState, int toState, char symbol) {
+    TraceEvent *grown;
+    TraceEvent *event;
+    int capacity;
+
+    if (result->traceCount == result->traceCapacity) {
+        capacity = result->traceCapacity > 0 ? result->traceCapacity * 2 : 16;
+        grown = realloc(result->trace, (size_t)capacity * sizeof(TraceEvent));
+        if (grown == NULL) {
+            return; /* out of memory: the trace is truncated, the verdict is not */
+        }
+        result->trace = grown;
+        result->traceCapacity = capacity;
+    }
+
+    event = &result->trace[result->traceCount++];
+    event->step = (unsigned int)step;
+    event->fromState = fromState;
+    event->toState = toState;
+    event->symbol = (unsigned char)symbol;
+    event->kind = (unsigned char)kind;
 }
 
 /* Process String */
-ProcessResult processString(FSM *fsm, const char *input) {
+ProcessResult processString(const FSM *fsm, const char *input) {
     ProcessResult result;
-    int i, transIndex, oldState;
+    FSMCursor cursor;
+    size_t i, length;
+    int transIndex, oldState;
     char symbol;
     
-    result.traceCount = 0;
     result.accepted = 0;
+    result.trace = NULL;
+    result.traceCount = 0;
+    result.traceCapacity = 0;
+    result.fsm = fsm;
     
-    resetFSM(fsm);
+    resetFSM(fsm, &cursor);
     
     /* Add initial trace */
-    sprintf(result.trace[result.traceCount].message, 
-            "Starting at state: %s", 
-            fsm->states[fsm->currentState].name);
-    result.traceCount++;
+    addTraceEvent(&result, TRACE_START, 0, -1, cursor.currentState, 0);
     
     /* Process each character */
-    for (i = 0; i < strlen(input); i++) {
+    length = strlen(input);
+    for (i = 0; i < length; i++) {
         symbol = input[i];
         
         /* Check if symbol is in alphabet */
         if (!charInAlphabet(fsm, symbol)) {
-            sprintf(result.trace[result.traceCount].message,
-                    "Error: '%c' not in alphabet", symbol);
-            result.traceCount++;
+            addTraceEvent(&result, TRACE_NOT_IN_ALPHABET, i, cursor.currentState, -1, symbol);
             return result;
         }
         
         /* Find transition */
-        transIndex = findTransition(fsm, fsm->currentState, symbol);
+        oldState = cursor.currentState;
+        transIndex = stepFSM(fsm, &cursor, symbol);
         
         if (transIndex >= 0) {
-            oldState = fsm->currentState;
-            fsm->currentState = fsm->transitions[transIndex].toState;
-            sprintf(result.trace[result.traceCount].message,
-                    "Read '%c': %s -> %s",
-                    symbol,
-                    fsm->states[oldState].name,
-                    fsm->states[fsm->currentState].name);
-            result.traceCount++;
+            addTraceEvent(&result, TRACE_STEP, i, oldState, cursor.currentState, symbol);
         } else {
-            sprintf(result.trace[result.traceCount].message,
-                    "No transition for '%c' from %s",
-                    symbol,
-                    fsm->states[fsm->currentState].name);
-            result.traceCount++;
+            addTraceEvent(&result, TRACE_NO_TRANSITION, i, cursor.currentState, -1, symbol);
             return result;
         }
     }
     
     /* Check if final state is accepting */
-    result.accepted = fsm->states[fsm->currentState].isAccepting;
-    
-    if (result.accepted) {
-        sprintf(result.trace[result.traceCount].message, "✓ String ACCEPTED");
-    } else {
-        sprintf(result.trace[result.traceCount].message, "✗ String REJECTED");
-    }
-    result.traceCount++;
+    result.accepted = fsm->states[cursor.currentState].isAccepting;
+    addTraceEvent(&result, result.accepted ? TRACE_ACCEPT : TRACE_REJECT,
+                  length, cursor.currentState, cursor.currentState, 0);
     
     return result;
 }
 
-/* Visualize FSM */
-void visualizeFSM(FSM *fsm) {
-    int i;
-    
-    printf("\n=== FSM Visualization ===\n");
-    
-    /* Display states */
-    printf("States: ");
-    for (i = 0; i < fsm->stateCount; i++) {
-        printf("%s", fsm->states[i].name);
-        if (i < fsm->stateCount - 1) {
-            printf(", ");
-        }
-    }
-    printf("\n");
-    
-    /* Display accept states */
-    printf("Accept States: ");
-    for (i = 0; i < fsm->stateCount; i++) {
-        if (fsm->states[i].isAccepting) {
-            printf("%s ", fsm->states[i].name);
+/* Free Process Result trace buffer */
+void freeProcessResult(ProcessResult *result) {
+    free(result->trace);
+    result->trace = NULL;
+    result->traceCount = 0;
+    result->traceCapacity = 0;
+}
+
+/* Match String: same verdict as processString without building a trace */
+MatchResult matchString(const FSM *fsm, const char *input, size_t length) {
+    MatchResult result;
+    int state = fsm->initialState;
+    int transIndex;
+    size_t i;
+
+    result.failOffset = -1;
+    for (i = 0; i < length; i++) {
+        if (!charInAlphabet(fsm, input[i]) ||
+            (transIndex = findTransition(fsm, state, input[i])) < 0) {
+            result.failOffset = (long)i;
+            break;
         }
+        state = fsm->transitions[transIndex].toState;
     }
-    printf("\n");
-    
-    printf("Initial State: %s\n", fsm->states[fsm->initialState].name);
-    
-    /* Display alphabet */
-    printf("Alphabet: {");
-    for (i = 0; i < fsm->alphabetSize; i++) {
-        printf("%c", fsm->alphabet[i]);
-        if (i < fsm->alphabetSize - 1) {
-            printf(", ");
-        }
+
+    result.finalState = state;
+    result.accepted = result.failOffset < 0 && fsm->states[state].isAccepting;
+    return result;
+}
+
+/* Set Compiled Entry: store one next-state offset at the table's width */
+static void setCompiledEntry(CompiledFSM *cfsm, size_t cell, unsigned int value) {
+    switch (cfsm->tableWidth) {
+        case 1:
+            ((unsigned char *)cfsm->table)[cell] = (unsigned char)value;
+            break;
+        case 2:
+            ((unsigned short *)cfsm->table)[cell] = (unsigned short)value;
+            break;
+        default:
+            ((unsigned int *)cfsm->table)[cell] = value;
+            break;
+    }
+}
+
+/* Compiled Entry: next-state offset in one table cell, for code off the hot path */
+static int compiledEntry(const CompiledFSM *cfsm, size_t cell) {
+    switch (cfsm->tableWidth) {
+        case 1:
+            return ((const unsigned char *)cfsm->table)[cell];
+        case 2:
+            return ((const unsigned short *)cfsm->table)[cell];
+        default:
+            return (int)((const unsigned int *)cfsm->table)[cell];
+    }
+}
+
+/* Compiled Target: index of the state entered from compiled index on symbol class cls */
+static int compiledTarget(const CompiledFSM *cfsm, int index, int cls) {
+    return compiledEntry(cfsm, (size_t)index * cfsm->classCount + cls) / cfsm->classCount;
+}
+
+/* Mark Live States: live[s] = 1 iff an accepting state is reachable from FSM
+   state s over columns (see compileTable), by a backward search from the
+   accepting states. Returns -1 if out of memory. */
+static int markLiveStates(const FSM *fsm, const int *columns, unsigned char *live) {
+    int stateCount = fsm->stateCount;
+    size_t edges = (size_t)fsm->alphabetSize * stateCount, e;
+    int *predStart = calloc((size_t)stateCount + 1, sizeof(int));
+    int *fill = malloc((size_t)(stateCount > 0 ? stateCount : 1) * sizeof(int));
+    int *pred = malloc((edges > 0 ? edges : 1) * sizeof(int));
+    int *queue = malloc((size_t)(stateCount > 0 ? stateCount : 1) * sizeof(int));
+    int s, t, head = 0, tail = 0;
+
+    if (predStart == NULL || fill == NULL || pred == NULL || queue == NULL) {
+        free(predStart);
+        free(fill);
+        free(pred);
+        free(queue);
+        return -1;
+    }
+
+    /* Predecessors of each target state, grouped by target */
+    for (e = 0; e < edges; e++) {
+        if (columns[e] != DEAD_STATE) {
+            predStart[columns[e]]++;
+        }
+    }
+    for (s = 0; s < stateCount; s++) {
+        predStart[s + 1] += predStart[s];
+    }
+    memcpy(fill, predStart, (size_t)stateCount * sizeof(int));
+    for (e = 0; e < edges; e++) {
+        if (columns[e] != DEAD_STATE) {
+            pred[fill[columns[e] - 1]++] = (int)(e % (size_t)stateCount);
+        }
+    }
+
+    for (s = 0; s < stateCount; s++) {
+        live[s] = fsm->states[s].isAccepting ? 1 : 0;
+        if (live[s]) {
+            queue[tail++] = s;
+        }
+    }
+    while (head < tail) {
+        t = queue[head++];
+        for (s = predStart[t]; s < predStart[t + 1]; s++) {
+            if (!live[pred[s]]) {
+                live[pred[s]] = 1;
+                queue[tail++] = pred[s];
+            }
+        }
+    }
+
+    free(predStart);
+    free(fill);
+    free(pred);
+    free(queue);
+    return 0;
+}
+
+/* Compile Table: compileFSM, optionally keeping every FSM state. Unpruned,
+   states that cannot reach acceptance keep their rows and nothing absorbs,
+   which is what minimizeFSM needs to count them itself. */
+static int compileTable(const FSM *fsm, CompiledFSM *cfsm, int prune) {
+    int i, a, b, s, c, cls, target, acceptIndex, absorbIndex;
+    int stateCount = fsm->stateCount;
+    int alphabetSize = fsm->alphabetSize;
+    int firstClass = alphabetSize < 256 ? 1 : 0;
+    int *columns, *indexOf;
+    unsigned char *kind; /* 0 = cannot accept, 1 = live, 2 = absorbing */
+    unsigned int hashes[MAX_ALPHABET];
+    int classOf[MAX_ALPHABET];
+    int representative[MAX_ALPHABET];
+    size_t cells;
+
+    cfsm->table = NULL;
+    cfsm->fsmStates = NULL;
+    cfsm->matchStart = NULL;
+    cfsm->matchIds = NULL;
+
+    for (i = 0; i < fsm->transitionCount; i++) {
+        if (fsm->transitions[i].isEpsilon) {
+            printf("Error: Cannot compile an FSM with epsilon transitions\n");
+            return -1;
+        }
+    }
+
+    /* columns[a * stateCount + s]: compiled next state of FSM state s on symbol a */
+    columns = calloc((size_t)(alphabetSize > 0 ? alphabetSize : 1) * (stateCount > 0 ? stateCount : 1),
+                     sizeof(int));
+    if (columns == NULL) {
+        printf("Error: Out of memory compiling FSM\n");
+        return -1;
+    }
+
+    /* Walk transitions in order so the first match wins, as in findTransition */
+    for (i = 0; i < fsm->transitionCount; i++) {
+        a = fsm->byteClass[(unsigned char)fsm->transitions[i].symbol] - 1;
+        s = fsm->transitions[i].fromState;
+        if (a < 0) {
+            continue; /* symbol dropped by a full alphabet */
+        }
+        if (columns[a * stateCount + s] == DEAD_STATE) {
+            columns[a * stateCount + s] = fsm->transitions[i].toState + 1;
+        }
+    }
+
+    /* Fold states that cannot reach acceptance into the dead state, and find
+       the accepting states every byte leaves in place */
+    kind = malloc((size_t)(stateCount > 0 ? stateCount : 1));
+    if (kind == NULL || (prune && markLiveStates(fsm, columns, kind) != 0)) {
+        printf("Error: Out of memory compiling FSM\n");
+        free(columns);
+        free(kind);
+        return -1;
+    }
+    for (s = 0; !prune && s < stateCount; s++) {
+        kind[s] = 1;
+    }
+    for (a = 0; a < alphabetSize; a++) {
+        for (s = 0; s < stateCount; s++) {
+            target = columns[a * stateCount + s];
+            if (kind[s] == 0 || (target != DEAD_STATE && kind[target - 1] == 0)) {
+                columns[a * stateCount + s] = DEAD_STATE;
+            }
+        }
+    }
+    for (s = 0; prune && firstClass == 0 && s < stateCount; s++) {
+        for (a = 0; kind[s] != 0 && a < alphabetSize; a++) {
+            if (columns[a * stateCount + s] != s + 1) {
+                break;
+            }
+        }
+        if (kind[s] != 0 && a == alphabetSize && fsm->states[s].isAccepting) {
+            kind[s] = 2;
+        }
+    }
+
+    /* Merge equivalent symbols; class 0 stays reserved for bytes outside the
+       alphabet, so at most 256 classes are ever needed */
+    cfsm->classCount = firstClass;
+    for (a = 0; a < alphabetSize; a++) {
+        hashes[a] = 2166136261u;
+        for (s = 0; s < stateCount; s++) {
+            hashes[a] = (hashes[a] ^ (unsigned int)columns[a * stateCount + s]) * 16777619u;
+        }
+
+        classOf[a] = -1;
+        for (cls = firstClass; cls < cfsm->classCount; cls++) {
+            b = representative[cls];
+            if (hashes[b] == hashes[a] &&
+                memcmp(&columns[b * stateCount], &columns[a * stateCount],
+                       stateCount * sizeof(int)) == 0) {
+                classOf[a] = cls;
+                break;
+            }
+        }
+        if (classOf[a] < 0) {
+            representative[cfsm->classCount] = a;
+            classOf[a] = cfsm->classCount++;
+        }
+    }
+
+    memset(cfsm->classMap, 0, sizeof(cfsm->classMap));
+    for (b = 0; b < 256; b++) {
+        if (fsm->byteClass[b] != 0) {
+            cfsm->classMap[b] = (unsigned char)classOf[fsm->byteClass[b] - 1];
+        }
+    }
+
+    cfsm->stateCount = 1;
+    for (s = 0; s < stateCount; s++) {
+        cfsm->stateCount += kind[s] != 0;
+    }
+    cells = (size_t)cfsm->stateCount * cfsm->classCount;
+    if (cells > 0x7FFFFFFFu) {
+        printf("Error: FSM too large to compile\n");
+        free(columns);
+        free(kind);
+        return -1;
+    }
+    cfsm->tableWidth = cells - cfsm->classCount <= 0xFFu ? 1 :
+                       cells - cfsm->classCount <= 0xFFFFu ? 2 : 4;
+
+    cfsm->table = calloc(cells, (size_t)cfsm->tableWidth);
+    cfsm->fsmStates = malloc((size_t)cfsm->stateCount * sizeof(int));
+    indexOf = malloc((size_t)(stateCount > 0 ? stateCount : 1) * sizeof(int));
+    if (cfsm->table == NULL || cfsm->fsmStates == NULL || indexOf == NULL) {
+        printf("Error: Out of memory compiling FSM\n");
+        free(columns);
+        free(indexOf);
+        free(kind);
+        freeCompiledFSM(cfsm);
+        return -1;
+    }
+
+    /* Rejecting states first, then accepting and finally absorbing states */
+    cfsm->fsmStates[DEAD_STATE] = -1;
+    c = 1;
+    for (s = 0; s < stateCount; s++) {
+        indexOf[s] = DEAD_STATE;
+        if (kind[s] == 1 && !fsm->states[s].isAccepting) {
+            cfsm->fsmStates[c] = s;
+            indexOf[s] = c++;
+        }
+    }
+    acceptIndex = c;
+    for (s = 0; s < stateCount; s++) {
+        if (kind[s] == 1 && fsm->states[s].isAccepting) {
+            cfsm->fsmStates[c] = s;
+            indexOf[s] = c++;
+        }
+    }
+    absorbIndex = c;
+    for (s = 0; s < stateCount; s++) {
+        if (kind[s] == 2) {
+            cfsm->fsmStates[c] = s;
+            indexOf[s] = c++;
+        }
+    }
+    cfsm->acceptStart = acceptIndex * cfsm->classCount;
+    cfsm->absorbStart = absorbIndex * cfsm->classCount;
+    cfsm->initialState = stateCount > 0 ? indexOf[fsm->initialState] * cfsm->classCount
+                                        : DEAD_STATE;
+
+    for (s = 0; s < stateCount; s++) {
+        if (kind[s] == 0) {
+            continue;
+        }
+        for (cls = firstClass; cls < cfsm->classCount; cls++) {
+            target = columns[representative[cls] * stateCount + s];
+            setCompiledEntry(cfsm, (size_t)indexOf[s] * cfsm->classCount + cls,
+                             target == DEAD_STATE ? DEAD_STATE :
+                             (unsigned int)(indexOf[target - 1] * cfsm->classCount));
+        }
+    }
+    free(indexOf);
+    free(kind);
+
+    /* Per-state pattern IDs, kept only when some state carries them */
+    for (s = 0, i = 0; s < stateCount; s++) {
+        i += fsm->states[s].matchCount;
+    }
+    if (i > 0) {
+        cfsm->matchStart = malloc(((size_t)cfsm->stateCount + 1) * sizeof(int));
+        cfsm->matchIds = malloc((size_t)i * sizeof(int));
+        if (cfsm->matchStart == NULL || cfsm->matchIds == NULL) {
+            printf("Error: Out of memory compiling FSM\n");
+            free(columns);
+            freeCompiledFSM(cfsm);
+            return -1;
+        }
+        /* Compiled index c owns matchIds[matchStart[c] .. matchStart[c + 1]) */
+        cfsm->matchStart[0] = 0;
+        cfsm->matchStart[1] = 0;
+        for (c = 1; c < cfsm->stateCount; c++) {
+            s = cfsm->fsmStates[c];
+            if (fsm->states[s].matchCount > 0) {
+                memcpy(&cfsm->matchIds[cfsm->matchStart[c]], fsm->states[s].matchIds,
+                       (size_t)fsm->states[s].matchCount * sizeof(int));
+            }
+            cfsm->matchStart[c + 1] = cfsm->matchStart[c] + fsm->states[s].matchCount;
+        }
+    }
+
+    free(columns);
+    return 0;
+}
+
+/* Compile FSM into a dense transition table.
+   Alphabet symbols whose columns are identical in every state share one class.
+   States that cannot reach an accepting state are dropped (they get no index),
+   and an accepting state whose every byte loops back to it is marked absorbing. */
+int compileFSM(const FSM *fsm, CompiledFSM *cfsm) {
+    return compileTable(fsm, cfsm, 1);
+}
+
+/* Free Compiled FSM */
+void freeCompiledFSM(CompiledFSM *cfsm) {
+    free(cfsm->table);
+    free(cfsm->fsmStates);
+    free(cfsm->matchStart);
+    free(cfsm->matchIds);
+    cfsm->table = NULL;
+    cfsm->fsmStates = NULL;
+    cfsm->matchStart = NULL;
+    cfsm->matchIds = NULL;
+    cfsm->stateCount = 0;
+    cfsm->classCount = 0;
+}
+
+#ifdef AUTOMATA_PROFILE
+/* Init Profile: zeroed merged counters for every cell of cfsm's table */
+int initProfile(CompiledProfile *profile, const CompiledFSM *cfsm) {
+    profile->cfsm = cfsm;
+    profile->cellHits = calloc((size_t)cfsm->stateCount * cfsm->classCount,
+                               sizeof(unsigned long long));
+    if (profile->cellHits == NULL) {
+        printf("Error: Out of memory for profile counters\n");
+        return -1;
+    }
+    pthread_mutex_init(&profile->lock, NULL);
+    return 0;
+}
+
+/* Free Profile: release merged counters; every thread must have detached */
+void freeProfile(CompiledProfile *profile) {
+    free(profile->cellHits);
+    profile->cellHits = NULL;
+    pthread_mutex_destroy(&profile->lock);
+}
+
+/* Profile Attach: count this thread's runs of profile->cfsm from now on,
+   detaching from any earlier profile first */
+int profileAttach(CompiledProfile *profile) {
+    profileDetach();
+    profileHits = calloc((size_t)profile->cfsm->stateCount * profile->cfsm->classCount,
+                         sizeof(unsigned long long));
+    if (profileHits == NULL) {
+        printf("Error: Out of memory for profile counters\n");
+        return -1;
+    }
+    profileTarget = profile;
+    return 0;
+}
+
+/* Profile Detach: fold this thread's counters into its profile and stop */
+void profileDetach(void) {
+    size_t cell, cells;
+
+    if (profileTarget == NULL) {
+        return;
+    }
+    cells = (size_t)profileTarget->cfsm->stateCount * profileTarget->cfsm->classCount;
+    pthread_mutex_lock(&profileTarget->lock);
+    for (cell = 0; cell < cells; cell++) {
+        profileTarget->cellHits[cell] += profileHits[cell];
+    }
+    pthread_mutex_unlock(&profileTarget->lock);
+    free(profileHits);
+    profileHits = NULL;
+    profileTarget = NULL;
+}
+
+/* Profile Cells: this thread's counters if it is profiling cfsm, else NULL */
+static unsigned long long *profileCells(const CompiledFSM *cfsm) {
+    return profileTarget != NULL && profileTarget->cfsm == cfsm ? profileHits : NULL;
+}
+
+/* Profile Counts: per-state visits, per-transition hits, dead exits and
+   alphabet rejections of fsm, the automaton profile->cfsm was compiled from */
+int profileCounts(const CompiledProfile *profile, const FSM *fsm, ProfileCounts *counts) {
+    const CompiledFSM *cfsm = profile->cfsm;
+    unsigned char foreign[256];
+    int *indexOf;
+    int c, cls, b, t;
+    size_t cell;
+
+    counts->stateVisits = calloc((size_t)(fsm->stateCount > 0 ? fsm->stateCount : 1),
+                                 sizeof(unsigned long long));
+    counts->transitionHits = calloc((size_t)(fsm->transitionCount > 0 ? fsm->transitionCount : 1),
+                                    sizeof(unsigned long long));
+    indexOf = malloc((size_t)(fsm->stateCount > 0 ? fsm->stateCount : 1) * sizeof(int));
+    if (counts->stateVisits == NULL || counts->transitionHits == NULL || indexOf == NULL) {
+        printf("Error: Out of memory for profile counts\n");
+        free(indexOf);
+        freeProfileCounts(counts);
+        return -1;
+    }
+    counts->deadExits = 0;
+    counts->alphabetRejections = 0;
+
+    /* A class is foreign when its bytes are outside the alphabet (class 0 of
+       a partial alphabet) */
+    memset(foreign, 0, sizeof(foreign));
+    for (b = 0; b < 256; b++) {
+        if (!charInAlphabet(fsm, (char)b)) {
+            foreign[cfsm->classMap[b]] = 1;
+        }
+    }
+
+    for (t = 0; t < fsm->stateCount; t++) {
+        indexOf[t] = DEAD_STATE; /* dropped by compileFSM, never entered */
+    }
+    for (c = 1; c < cfsm->stateCount; c++) {
+        indexOf[cfsm->fsmStates[c]] = c;
+        for (cls = 0; cls < cfsm->classCount; cls++) {
+            cell = (size_t)c * cfsm->classCount + cls;
+            counts->stateVisits[cfsm->fsmStates[c]] += profile->cellHits[cell];
+            if (compiledEntry(cfsm, cell) != DEAD_STATE) {
+                continue;
+            }
+            if (foreign[cls]) {
+                counts->alphabetRejections += profile->cellHits[cell];
+            } else {
+                counts->deadExits += profile->cellHits[cell];
+            }
+        }
+    }
+
+    for (t = 0; t < fsm->transitionCount; t++) {
+        if (!fsm->transitions[t].isEpsilon &&
+            indexOf[fsm->transitions[t].fromState] != DEAD_STATE) {
+            counts->transitionHits[t] =
+                profile->cellHits[(size_t)indexOf[fsm->transitions[t].fromState] *
+                                  cfsm->classCount +
+                                  cfsm->classMap[(unsigned char)fsm->transitions[t].symbol]];
+        }
+    }
+    free(indexOf);
+    return 0;
+}
+#endif
+
+/* Free Profile Counts */
+void freeProfileCounts(ProfileCounts *counts) {
+    free(counts->stateVisits);
+    free(counts->transitionHits);
+    counts->stateVisits = NULL;
+    counts->transitionHits = NULL;
+}
+
+/* Run Table: advance *state over input, stopping before the first dead
+   transition. Entering an absorbing state settles the rest of the input, which
+   counts as consumed. Returns the number of bytes consumed. */
+static size_t runTable(const CompiledFSM *cfsm, int *state,
+                       const unsigned char *input, size_t length) {
+    const unsigned char *classMap = cfsm->classMap;
+    unsigned int current = (unsigned int)*state;
+    unsigned int next = DEAD_STATE;
+    unsigned int absorbLimit = (unsigned int)cfsm->absorbStart - 1; /* dead wraps above it */
+    size_t i = 0;
+#ifdef AUTOMATA_PROFILE
+    unsigned long long *hits = profileCells(cfsm);
+#endif
+
+#define RUN_TABLE_LOOP(type)                                                \
+    for (; i < length; i++) {                                               \
+        next = ((const type *)cfsm->table)[current + classMap[input[i]]];   \
+        PROFILE_HIT(hits, current + classMap[input[i]]);                    \
+        if (next - 1 >= absorbLimit) {                                      \
+            break;                                                          \
+        }                                                                   \
+        current = next;                                                     \
+    }
+
+    switch (cfsm->tableWidth) {
+        case 1:
+            RUN_TABLE_LOOP(unsigned char)
+            break;
+        case 2:
+            RUN_TABLE_LOOP(unsigned short)
+            break;
+        default:
+            RUN_TABLE_LOOP(unsigned int)
+            break;
+    }
+#undef RUN_TABLE_LOOP
+
+    if (i < length && next != DEAD_STATE) {
+        current = next;
+        i = length;
+    }
+    *state = (int)current;
+    return i;
+}
+
+/* Run Compiled FSM: one table load per input byte */
+int runCompiledFSM(const CompiledFSM *cfsm, const char *input, size_t length) {
+    int state = cfsm->initialState;
+
+    if (runTable(cfsm, &state, (const unsigned char *)input, length) < length) {
+        return 0;
+    }
+    return COMPILED_ACCEPTING(cfsm, state);
+}
+
+/* Match Compiled FSM: runCompiledFSM plus final state and failure offset */
+MatchResult matchCompiledFSM(const CompiledFSM *cfsm, const char *input, size_t length) {
+    MatchResult result;
+    int state = cfsm->initialState;
+    size_t consumed = runTable(cfsm, &state, (const unsigned char *)input, length);
+
+    result.failOffset = consumed < length ? (long)consumed : -1;
+    result.finalState = cfsm->fsmStates[state / cfsm->classCount];
+    result.accepted = result.failOffset < 0 && COMPILED_ACCEPTING(cfsm, state);
+    return result;
+}
+
+/* Match Compiled IDs: run the whole input and point *ids at the pattern IDs of
+   the final state. Returns how many patterns matched. */
+int matchCompiledIds(const CompiledFSM *cfsm, const char *input, size_t length,
+                     const int **ids) {
+    int state = cfsm->initialState;
+
+    *ids = NULL;
+    if (cfsm->matchStart == NULL ||
+        runTable(cfsm, &state, (const unsigned char *)input, length) < length) {
+        return 0;
+    }
+    state /= cfsm->classCount;
+    *ids = &cfsm->matchIds[cfsm->matchStart[state]];
+    return cfsm->matchStart[state + 1] - cfsm->matchStart[state];
+}
+
+/* Reserve Packed Slots: grow entries and their free-slot links to at least need */
+static int reservePackedSlots(PackedFSM *packed, int **nextFree, size_t *capacity,
+                              size_t need) {
+    PackedEntry *entries;
+    int *links;
+    size_t grown = *capacity, j;
+
+    while (grown < need) {
+        grown *= 2;
+    }
+    if (grown == *capacity) {
+        return 0;
+    }
+    entries = realloc(packed->entries, grown * sizeof(PackedEntry));
+    if (entries == NULL) {
+        return -1;
+    }
+    packed->entries = entries;
+    links = realloc(*nextFree, (grown + 1) * sizeof(int));
+    if (links == NULL) {
+        return -1;
+    }
+    *nextFree = links;
+    for (j = *capacity; j < grown; j++) {
+        packed->entries[j].owner = -1;
+        packed->entries[j].target = DEAD_STATE;
+    }
+    for (j = *capacity + 1; j <= grown; j++) {
+        links[j] = (int)j;
+    }
+    *capacity = grown;
+    return 0;
+}
+
+/* Find Free Slot: lowest free entry at or after j (capacity if none), with
+   path halving over the links of taken entries */
+static int findFreeSlot(int *nextFree, int j) {
+    while (nextFree[j] != j) {
+        nextFree[j] = nextFree[nextFree[j]];
+        j = nextFree[j];
+    }
+    return j;
+}
+
+/* Pack Compiled FSM: comb-compress cfsm's table, choosing per state by density.
+   Rows storing more than half their cells are appended at the end of the entry
+   array. Sparser rows, most cells first, are tried at up to PACK_MAX_TRIES free
+   gaps near the end, where gaps are fresh, and appended only if none fits. */
+int packCompiledFSM(const CompiledFSM *cfsm, PackedFSM *packed) {
+    int n = cfsm->stateCount, k = cfsm->classCount;
+    int *stamp = malloc((size_t)n * sizeof(int));
+    int *tally = malloc((size_t)n * sizeof(int));
+    int *stored = malloc((size_t)n * sizeof(int));
+    int *byStored = malloc((size_t)n * sizeof(int));
+    int *position = calloc((size_t)k + 1, sizeof(int));
+    int *cells = malloc((size_t)k * sizeof(int));
+    int *nextFree = NULL;
+    size_t capacity = (size_t)k, limit = (size_t)k, end = 0, total = 0, j;
+    int status = -1;
+    int i, q, c, t, base, slot, tries, count, fits;
+
+    packed->rows = malloc((size_t)n * sizeof(PackedRow));
+    packed->fsmStates = malloc((size_t)n * sizeof(int));
+    packed->entries = NULL;
+    if (stamp == NULL || tally == NULL || stored == NULL || byStored == NULL ||
+        position == NULL || cells == NULL || packed->rows == NULL ||
+        packed->fsmStates == NULL) {
+        goto outOfMemory;
+    }
+    memcpy(packed->classMap, cfsm->classMap, sizeof(packed->classMap));
+    memcpy(packed->fsmStates, cfsm->fsmStates, (size_t)n * sizeof(int));
+    packed->classCount = k;
+    packed->stateCount = n;
+    packed->initialState = cfsm->initialState / k;
+    packed->acceptStart = cfsm->acceptStart / k;
+    packed->absorbStart = cfsm->absorbStart / k;
+
+    /* Fallback = most common target of each row */
+    for (q = 0; q < n; q++) {
+        stamp[q] = -1;
+    }
+    for (q = 0; q < n; q++) {
+        packed->rows[q].base = 0;
+        packed->rows[q].fallback = DEAD_STATE;
+        count = 0;
+        for (c = 0; c < k; c++) {
+            t = compiledTarget(cfsm, q, c);
+            if (stamp[t] != q) {
+                stamp[t] = q;
+                tally[t] = 0;
+            }
+            if (++tally[t] > count) {
+                count = tally[t];
+                packed->rows[q].fallback = t;
+            }
+        }
+        stored[q] = k - count;
+        position[stored[q]]++;
+        total += (size_t)stored[q];
+    }
+
+    /* Most stored cells first: position[v] = rows storing more than v */
+    for (i = k, count = 0; i >= 0; i--) {
+        t = position[i];
+        position[i] = count;
+        count += t;
+    }
+    for (q = 0; q < n; q++) {
+        byStored[position[stored[q]]++] = q;
+    }
+
+    capacity += total;
+    packed->entries = malloc(capacity * sizeof(PackedEntry));
+    nextFree = malloc((capacity + 1) * sizeof(int));
+    if (packed->entries == NULL || nextFree == NULL) {
+        goto outOfMemory;
+    }
+    for (j = 0; j < capacity; j++) {
+        packed->entries[j].owner = -1;
+        packed->entries[j].target = DEAD_STATE;
+        nextFree[j] = (int)j;
+    }
+    nextFree[capacity] = (int)capacity;
+
+    for (i = 0; i < n && stored[byStored[i]] > 0; i++) {
+        q = byStored[i];
+        count = 0;
+        for (c = 0; c < k; c++) {
+            if (compiledTarget(cfsm, q, c) != packed->rows[q].fallback) {
+                cells[count++] = c;
+            }
+        }
+
+        /* Past the end everything is free, so appending always fits */
+        base = (int)end > cells[0] ? (int)end - cells[0] : 0;
+        if (count * 2 <= k) {
+            slot = findFreeSlot(nextFree, (int)end > PACK_WINDOW + cells[0] ?
+                                          (int)end - PACK_WINDOW : cells[0]);
+            for (tries = 0; tries < PACK_MAX_TRIES && (size_t)slot < end; tries++) {
+                for (c = 1, fits = 1; c < count && fits; c++) {
+                    j = (size_t)(slot - cells[0] + cells[c]);
+                    fits = j >= end || packed->entries[j].owner < 0;
+                }
+                if (fits) {
+                    base = slot - cells[0];
+                    break;
+                }
+                slot = findFreeSlot(nextFree, slot + 1);
+            }
+        }
+        if (reservePackedSlots(packed, &nextFree, &capacity, (size_t)base + k) != 0) {
+            goto outOfMemory;
+        }
+
+        packed->rows[q].base = base;
+        for (c = 0; c < count; c++) {
+            slot = base + cells[c];
+            packed->entries[slot].owner = q;
+            packed->entries[slot].target = compiledTarget(cfsm, q, cells[c]);
+            nextFree[slot] = slot + 1;
+        }
+        if ((size_t)base + cells[count - 1] + 1 > end) {
+            end = (size_t)base + cells[count - 1] + 1;
+        }
+        if ((size_t)base + k > limit) {
+            limit = (size_t)base + k;
+        }
+    }
+
+    if (limit > 0x7FFFFFFFu) {
+        printf("Error: FSM too large to pack\n");
+        goto done;
+    }
+    packed->entryCount = (int)limit;
+    if (limit < capacity) {
+        PackedEntry *shrunk = realloc(packed->entries, limit * sizeof(PackedEntry));
+
+        if (shrunk != NULL) {
+            packed->entries = shrunk;
+        }
+    }
+    status = 0;
+    goto done;
+
+outOfMemory:
+    printf("Error: Out of memory packing FSM\n");
+done:
+    if (status != 0) {
+        freePackedFSM(packed);
+    }
+    free(stamp);
+    free(tally);
+    free(stored);
+    free(byStored);
+    free(position);
+    free(cells);
+    free(nextFree);
+    return status;
+}
+
+/* Free Packed FSM */
+void freePackedFSM(PackedFSM *packed) {
+    free(packed->rows);
+    free(packed->entries);
+    free(packed->fsmStates);
+    packed->rows = NULL;
+    packed->entries = NULL;
+    packed->fsmStates = NULL;
+    packed->stateCount = 0;
+    packed->entryCount = 0;
+}
+
+/* Run Packed: runTable for a packed FSM, one owner check per byte */
+static size_t runPacked(const PackedFSM *packed, int *state, const unsigned char *input,
+                        size_t length) {
+    const PackedRow *rows = packed->rows;
+    const PackedEntry *entry;
+    int current = *state, next;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        entry = &packed->entries[rows[current].base + packed->classMap[input[i]]];
+        next = entry->owner == current ? entry->target : rows[current].fallback;
+        if (next == DEAD_STATE) {
+            break;
+        }
+        current = next;
+        if (current >= packed->absorbStart) {
+            i = length;
+            break;
+        }
+    }
+    *state = current;
+    return i;
+}
+
+/* Run Packed FSM: runCompiledFSM over the comb-compressed table */
+int runPackedFSM(const PackedFSM *packed, const char *input, size_t length) {
+    int state = packed->initialState;
+
+    if (runPacked(packed, &state, (const unsigned char *)input, length) < length) {
+        return 0;
+    }
+    return state >= packed->acceptStart;
+}
+
+/* Match Packed FSM: matchCompiledFSM over the comb-compressed table */
+MatchResult matchPackedFSM(const PackedFSM *packed, const char *input, size_t length) {
+    MatchResult result;
+    int state = packed->initialState;
+    size_t consumed = runPacked(packed, &state, (const unsigned char *)input, length);
+
+    result.failOffset = consumed < length ? (long)consumed : -1;
+    result.finalState = packed->fsmStates[state];
+    result.accepted = result.failOffset < 0 && state >= packed->acceptStart;
+    return result;
+}
+
+/* Set Batch Result: record one input's verdict; consumed < length means it died */
+static int setBatchResult(const CompiledFSM *cfsm, BatchResult *result, int state,
+                          size_t consumed, size_t length) {
+    if (consumed < length) {
+        result->accepted = 0;
+        result->failOffset = consumed < BATCH_NO_FAILURE ?
+                             (unsigned int)consumed : BATCH_NO_FAILURE - 1;
+        return 0;
+    }
+    result->accepted = COMPILED_ACCEPTING(cfsm, state);
+    result->failOffset = BATCH_NO_FAILURE;
+    return result->accepted;
+}
+
+/* Match Batch: run every input against one compiled FSM.
+   Returns the number of accepted inputs. */
+size_t matchBatch(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                  BatchResult *results) {
+    size_t i, consumed, acceptedCount = 0;
+    int state;
+
+    for (i = 0; i < count; i++) {
+        state = cfsm->initialState;
+        consumed = runTable(cfsm, &state, (const unsigned char *)inputs[i].data,
+                            inputs[i].length);
+        acceptedCount += setBatchResult(cfsm, &results[i], state, consumed, inputs[i].length);
+    }
+
+    return acceptedCount;
+}
+
+/* Match Batch Interleaved: matchBatch with INTERLEAVE_LANES inputs in flight.
+   Each lane's next-state load depends only on its own previous one, so the
+   lanes' table lookups overlap instead of forming one long dependency chain.
+   Lanes run INTERLEAVE_BLOCK bytes at a time without branching (the dead state
+   absorbs); a lane that died is replayed over its last block for the exact
+   failure offset. Finished lanes are refilled from the remaining inputs. */
+size_t matchBatchInterleaved(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                             BatchResult *results) {
+    static const unsigned char idle[INTERLEAVE_BLOCK];
+    const unsigned char *data[INTERLEAVE_LANES];
+    const unsigned char *classMap = cfsm->classMap;
+    int state[INTERLEAVE_LANES], blockState[INTERLEAVE_LANES];
+    size_t input[INTERLEAVE_LANES], remaining[INTERLEAVE_LANES];
+    size_t nextInput = 0, acceptedCount = 0, step, k, consumed;
+    int l, active = 0;
+
+#ifdef AUTOMATA_PROFILE
+    /* Replaying dead lanes would count their bytes twice */
+    if (profileCells(cfsm) != NULL) {
+        return matchBatch(cfsm, inputs, count, results);
+    }
+#endif
+    for (l = 0; l < INTERLEAVE_LANES; l++) {
+        remaining[l] = 0; /* idle lane: parked in the dead state over a dummy buffer */
+        state[l] = DEAD_STATE;
+        data[l] = idle;
+    }
+
+    for (;;) {
+        /* Refill idle lanes; empty inputs finish without entering a lane */
+        for (l = 0; l < INTERLEAVE_LANES; l++) {
+            while (remaining[l] == 0 && nextInput < count) {
+                if (inputs[nextInput].length == 0) {
+                    acceptedCount += setBatchResult(cfsm, &results[nextInput],
+                                                    cfsm->initialState, 0, 0);
+                    nextInput++;
+                    continue;
+                }
+                input[l] = nextInput++;
+                data[l] = (const unsigned char *)inputs[input[l]].data;
+                remaining[l] = inputs[input[l]].length;
+                state[l] = cfsm->initialState;
+                active++;
+            }
+        }
+        if (active == 0) {
+            break;
+        }
+
+        step = INTERLEAVE_BLOCK;
+        for (l = 0; l < INTERLEAVE_LANES; l++) {
+            blockState[l] = state[l];
+            if (remaining[l] > 0 && remaining[l] < step) {
+                step = remaining[l];
+            }
+        }
+
+#define INTERLEAVE_LOOP(type)                                                       \
+        for (k = 0; k < step; k++) {                                                \
+            for (l = 0; l < INTERLEAVE_LANES; l++) {                                \
+                state[l] = ((const type *)cfsm->table)[state[l] + classMap[data[l][k]]]; \
+            }                                                                       \
+        }
+
+        switch (cfsm->tableWidth) {
+            case 1:
+                INTERLEAVE_LOOP(unsigned char)
+                break;
+            case 2:
+                INTERLEAVE_LOOP(unsigned short)
+                break;
+            default:
+                INTERLEAVE_LOOP(unsigned int)
+                break;
+        }
+#undef INTERLEAVE_LOOP
+
+        for (l = 0; l < INTERLEAVE_LANES; l++) {
+            if (remaining[l] == 0) {
+                continue;
+            }
+            data[l] += step;
+            remaining[l] -= step;
+            if (state[l] != DEAD_STATE && state[l] < cfsm->absorbStart && remaining[l] > 0) {
+                continue;
+            }
+
+            consumed = state[l] >= cfsm->absorbStart ? inputs[input[l]].length
+                                                     : inputs[input[l]].length - remaining[l];
+            if (state[l] == DEAD_STATE) {
+                state[l] = blockState[l];
+                consumed = consumed - step +
+                           runTable(cfsm, &state[l], data[l] - step, step);
+            }
+            acceptedCount += setBatchResult(cfsm, &results[input[l]], state[l], consumed,
+                                            inputs[input[l]].length);
+            remaining[l] = 0;
+            state[l] = DEAD_STATE;
+            data[l] = idle;
+            active--;
+        }
+    }
+
+    return acceptedCount;
+}
+
+#define RANGE_PACK(next, end) (((unsigned long long)(end) << 32) | (unsigned long long)(next))
+#define RANGE_NEXT(range) ((unsigned int)((range) & 0xFFFFFFFFu))
+#define RANGE_END(range) ((unsigned int)((range) >> 32))
+
+/* Take Own Chunk: pop from the front of the worker's range, -1 when empty */
+static long takeOwnChunk(BatchWorker *worker) {
+    unsigned long long range = atomic_load(&worker->range);
+
+    while (RANGE_NEXT(range) < RANGE_END(range)) {
+        if (atomic_compare_exchange_weak(&worker->range, &range,
+                                         RANGE_PACK(RANGE_NEXT(range) + 1, RANGE_END(range)))) {
+            return (long)RANGE_NEXT(range);
+        }
+    }
+    return -1;
+}
+
+/* Steal Chunks: move the back half of a victim's range to the thief, -1 when
+   every worker is empty. The thief's own range must be empty. */
+static long stealChunks(BatchWorker *thief) {
+    const BatchJob *job = thief->job;
+    BatchWorker *victim;
+    unsigned long long range;
+    unsigned int next, end, split;
+    int attempt;
+
+    for (attempt = 1; attempt < job->workerCount; attempt++) {
+        victim = &job->workers[(thief->index + attempt) % job->workerCount];
+        range = atomic_load(&victim->range);
+        while ((next = RANGE_NEXT(range)) < (end = RANGE_END(range))) {
+            split = end - (end - next + 1) / 2;
+            if (atomic_compare_exchange_weak(&victim->range, &range, RANGE_PACK(next, split))) {
+                atomic_store(&thief->range, RANGE_PACK(split + 1, end));
+                return (long)split;
+            }
+        }
+    }
+    return -1;
+}
+
+/* Batch Worker Main: drain own chunks, then steal until all work is gone */
+static void *batchWorkerMain(void *arg) {
+    BatchWorker *worker = arg;
+    const BatchJob *job = worker->job;
+    size_t first, count;
+    long chunk;
+#ifdef AUTOMATA_PROFILE
+    int attached = job->profile != NULL && profileTarget == NULL &&
+                   profileAttach(job->profile) == 0;
+#endif
+
+    for (;;) {
+        chunk = takeOwnChunk(worker);
+        if (chunk < 0 && (chunk = stealChunks(worker)) < 0) {
+            break;
+        }
+        first = (size_t)chunk * job->chunkSize;
+        count = job->count - first < job->chunkSize ? job->count - first : job->chunkSize;
+        if (job->cache != NULL) {
+            worker->acceptedCount += matchBatchCached(job->cfsm, job->automatonId,
+                                                      &job->cache->shards[worker->index],
+                                                      job->inputs + first, count,
+                                                      job->results + first);
+        } else {
+            worker->acceptedCount += matchBatchInterleaved(job->cfsm, job->inputs + first,
+                                                           count, job->results + first);
+        }
+    }
+#ifdef AUTOMATA_PROFILE
+    if (attached) {
+        profileDetach();
+    }
+#endif
+    return NULL;
+}
+
+/* Run Batch Job: matchBatchParallel over threadCount threads, through cache
+   (one shard per thread) unless it is NULL */
+static size_t runBatchJob(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                          BatchResult *results, int threadCount, ResultCache *cache,
+                          unsigned int automatonId) {
+    BatchJob job;
+    BatchWorker *workers;
+    size_t chunkCount, perWorker, acceptedCount = 0;
+    int i, started;
+
+    if (threadCount <= 1 || count < 2) {
+        return cache != NULL ?
+               matchBatchCached(cfsm, automatonId, &cache->shards[0], inputs, count, results) :
+               matchBatch(cfsm, inputs, count, results);
+    }
+
+    /* Aim for ~32 chunks per thread so stealing can even out skewed record lengths */
+    job.chunkSize = count / ((size_t)threadCount * 32);
+    if (job.chunkSize < 16) {
+        job.chunkSize = 16;
+    }
+    while ((count + job.chunkSize - 1) / job.chunkSize > 0xFFFFFFFFu) {
+        job.chunkSize *= 2;
+    }
+    chunkCount = (count + job.chunkSize - 1) / job.chunkSize;
+    if ((size_t)threadCount > chunkCount) {
+        threadCount = (int)chunkCount;
+    }
+
+    workers = calloc((size_t)threadCount, sizeof(BatchWorker));
+    if (workers == NULL) {
+        return runBatchJob(cfsm, inputs, count, results, 1, cache, automatonId);
+    }
+
+    job.cfsm = cfsm;
+    job.inputs = inputs;
+    job.results = results;
+    job.count = count;
+    job.workers = workers;
+    job.workerCount = threadCount;
+    job.cache = cache;
+    job.automatonId = automatonId;
+#ifdef AUTOMATA_PROFILE
+    job.profile = profileCells(cfsm) != NULL ? profileTarget : NULL;
+#endif
+
+    perWorker = chunkCount / threadCount;
+    for (i = 0; i < threadCount; i++) {
+        workers[i].job = &job;
+        workers[i].index = i;
+        atomic_init(&workers[i].range,
+                    RANGE_PACK(i * perWorker,
+                               i == threadCount - 1 ? chunkCount : (i + 1) * perWorker));
+    }
+
+    /* The calling thread is worker 0; a failed spawn just leaves more to steal */
+    for (started = 1; started < threadCount; started++) {
+        if (pthread_create(&workers[started].thread, NULL, batchWorkerMain,
+                           &workers[started]) != 0) {
+            break;
+        }
+    }
+    batchWorkerMain(&workers[0]);
+    for (i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    for (i = started; i < threadCount; i++) {
+        batchWorkerMain(&workers[i]);
+    }
+
+    for (i = 0; i < threadCount; i++) {
+        acceptedCount += workers[i].acceptedCount;
+    }
+    free(workers);
+    return acceptedCount;
+}
+
+/* Match Batch Parallel: matchBatch split across threads with work stealing.
+   threadCount <= 0 uses every online CPU. Returns the number of accepted inputs. */
+size_t matchBatchParallel(const CompiledFSM *cfsm, const MatchInput *inputs, size_t count,
+                          BatchResult *results, int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return runBatchJob(cfsm, inputs, count, results, threadCount, NULL, 0);
+}
+
+/* Init Result Cache: shardCount shards (<= 0: one per online CPU) of about
+   entriesPerShard entries each, rounded up to a power-of-two number of sets */
+int initResultCache(ResultCache *cache, int shardCount, size_t entriesPerShard) {
+    size_t sets = 1;
+    int i;
+
+    if (shardCount <= 0) {
+        shardCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        shardCount = shardCount > 0 ? shardCount : 1;
+    }
+    while (sets * RESULT_CACHE_WAYS < entriesPerShard) {
+        sets *= 2;
+    }
+    cache->shardCount = shardCount;
+    cache->shards = calloc((size_t)shardCount, sizeof(ResultCacheShard));
+    if (cache->shards == NULL) {
+        printf("Error: Out of memory for result cache\n");
+        return -1;
+    }
+    for (i = 0; i < shardCount; i++) {
+        cache->shards[i].setMask = sets - 1;
+        cache->shards[i].entries = calloc(sets * RESULT_CACHE_WAYS, sizeof(ResultCacheEntry));
+        if (cache->shards[i].entries == NULL) {
+            printf("Error: Out of memory for result cache\n");
+            freeResultCache(cache);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Free Result Cache */
+void freeResultCache(ResultCache *cache) {
+    int i;
+
+    for (i = 0; cache->shards != NULL && i < cache->shardCount; i++) {
+        free(cache->shards[i].entries);
+    }
+    free(cache->shards);
+    cache->shards = NULL;
+    cache->shardCount = 0;
+}
+
+/* Result Cache Stats: hit, miss and bypass counts summed over every shard.
+   Read them only while no batch is running. */
+void resultCacheStats(const ResultCache *cache, ResultCacheStats *stats) {
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    for (i = 0; i < cache->shardCount; i++) {
+        stats->hits += cache->shards[i].stats.hits;
+        stats->misses += cache->shards[i].stats.misses;
+        stats->bypasses += cache->shards[i].stats.bypasses;
+    }
+}
+
+/* Match Batch Cached: matchBatch that answers repeated short inputs from shard.
+   automatonId tells automata sharing a cache apart and must be unique to cfsm.
+   Only one thread may use shard at a time. Returns the number of accepted inputs. */
+size_t matchBatchCached(const CompiledFSM *cfsm, unsigned int automatonId,
+                        ResultCacheShard *shard, const MatchInput *inputs, size_t count,
+                        BatchResult *results) {
+    const unsigned char *data;
+    ResultCacheEntry *set, found;
+    size_t i, j, length, acceptedCount = 0;
+    unsigned int hash;
+    int state, way;
+
+    for (i = 0; i < count; i++) {
+        data = (const unsigned char *)inputs[i].data;
+        length = inputs[i].length;
+        if (length > RESULT_CACHE_MAX_KEY) {
+            shard->stats.bypasses++;
+            state = cfsm->initialState;
+            acceptedCount += setBatchResult(cfsm, &results[i], state,
+                                            runTable(cfsm, &state, data, length), length);
+            continue;
+        }
+
+        hash = (2166136261u ^ automatonId) * 16777619u;
+        for (j = 0; j < length; j++) {
+            hash = (hash ^ data[j]) * 16777619u;
+        }
+        hash = hash != 0 ? hash : 1;
+        set = &shard->entries[(hash & shard->setMask) * RESULT_CACHE_WAYS];
+        for (way = 0; way < RESULT_CACHE_WAYS; way++) {
+            if (set[way].hash == hash && set[way].automatonId == automatonId &&
+                set[way].length == length && memcmp(set[way].key, data, length) == 0) {
+                break;
+            }
+        }
+
+        if (way < RESULT_CACHE_WAYS) {
+            shard->stats.hits++;
+            found = set[way];
+        } else {
+            shard->stats.misses++;
+            way = RESULT_CACHE_WAYS - 1; /* evict the least recently used */
+            state = cfsm->initialState;
+            setBatchResult(cfsm, &found.result, state,
+                           runTable(cfsm, &state, data, length), length);
+            found.hash = hash;
+            found.automatonId = automatonId;
+            found.length = (unsigned char)length;
+            memcpy(found.key, data, length);
+        }
+        memmove(&set[1], &set[0], (size_t)way * sizeof(ResultCacheEntry));
+        set[0] = found;
+        results[i] = found.result;
+        acceptedCount += found.result.accepted;
+    }
+
+    return acceptedCount;
+}
+
+/* Match Batch Parallel Cached: matchBatchParallel with one thread per shard of
+   cache, each answering repeats from its own shard */
+size_t matchBatchParallelCached(const CompiledFSM *cfsm, unsigned int automatonId,
+                                ResultCache *cache, const MatchInput *inputs, size_t count,
+                                BatchResult *results) {
+    return runBatchJob(cfsm, inputs, count, results, cache->shardCount, cache, automatonId);
+}
+
+/* Run Chunk Main: fill in one ChunkRun's lanes (thread body) */
+static void *runChunkMain(void *arg) {
+    ChunkRun *chunk = arg;
+    const CompiledFSM *cfsm = chunk->cfsm;
+    int n = cfsm->stateCount, k = cfsm->classCount;
+    int *stamp = malloc((size_t)n * sizeof(int));
+    int *lanes = malloc((size_t)n * sizeof(int));
+    int *next = malloc((size_t)n * sizeof(int));
+    int i, l, q, laneCount = 0, activeCount, kept, round = 0;
+    size_t at, stop, used;
+
+    chunk->laneOf = malloc((size_t)n * sizeof(int));
+    chunk->laneState = malloc((size_t)n * sizeof(int));
+    chunk->laneFail = malloc((size_t)n * sizeof(size_t));
+    chunk->parent = malloc((size_t)n * sizeof(int));
+    chunk->gaveUp = 1;
+    if (stamp == NULL || lanes == NULL || next == NULL || chunk->laneOf == NULL ||
+        chunk->laneState == NULL || chunk->laneFail == NULL || chunk->parent == NULL) {
+        goto done;
+    }
+
+    /* Lookback: the image of every live state under the bytes before begin.
+       Lanes keep stepping after they merge to one, so each holds a state at begin. */
+    for (q = 0; q < n; q++) {
+        stamp[q] = -1;
+        chunk->laneOf[q] = -1;
+    }
+    for (q = 1; q < n; q++) {
+        lanes[laneCount++] = q * k;
+    }
+    for (at = chunk->lookback; at < chunk->begin && laneCount > 0; at++, round++) {
+        for (i = 0, kept = 0; i < laneCount; i++) {
+            q = compiledEntry(cfsm, (size_t)lanes[i] + cfsm->classMap[chunk->data[at]]);
+            if (q != DEAD_STATE && stamp[q / k] != round) {
+                stamp[q / k] = round;
+                next[kept++] = q;
+            }
+        }
+        memcpy(lanes, next, (size_t)kept * sizeof(int));
+        laneCount = kept;
+    }
+    if (laneCount > CHUNK_MAX_LANES) {
+        goto done;
+    }
+
+    for (l = 0; l < laneCount; l++) {
+        chunk->laneOf[lanes[l] / k] = l;
+        chunk->laneState[l] = lanes[l];
+        chunk->laneFail[l] = CHUNK_LIVE;
+        chunk->parent[l] = l;
+        next[l] = l; /* active lanes */
+    }
+    activeCount = laneCount;
+    for (at = chunk->begin; at < chunk->end && activeCount > 0; at = stop) {
+        stop = chunk->end - at > CHUNK_MERGE_BLOCK ? at + CHUNK_MERGE_BLOCK : chunk->end;
+        for (i = 0, kept = 0, round++; i < activeCount; i++) {
+            l = next[i];
+            used = runTable(cfsm, &chunk->laneState[l], chunk->data + at, stop - at);
+            if (used < stop - at) {
+                chunk->laneFail[l] = at + used;
+                continue;
+            }
+            q = chunk->laneState[l] / k;
+            if (stamp[q] == round) {
+                chunk->parent[l] = lanes[q]; /* same state as an earlier lane */
+                continue;
+            }
+            stamp[q] = round;
+            lanes[q] = l;
+            next[kept++] = l;
+        }
+        activeCount = kept;
+    }
+    chunk->gaveUp = 0;
+
+done:
+    free(stamp);
+    free(lanes);
+    free(next);
+    return NULL;
+}
+
+/* Free Chunk Run */
+static void freeChunkRun(ChunkRun *chunk) {
+    free(chunk->laneOf);
+    free(chunk->laneState);
+    free(chunk->laneFail);
+    free(chunk->parent);
+}
+
+/* Match Compiled Parallel: matchCompiledFSM over one large input split into
+   chunks across threadCount threads (<= 0: every online CPU). Each chunk but the
+   first is matched speculatively as a ChunkRun, mapping its possible start
+   states to where they end; the maps are then composed in order from the
+   initial state. Worthwhile for DFAs whose lanes converge, which small ones do
+   almost at once. */
+MatchResult matchCompiledParallel(const CompiledFSM *cfsm, const char *input, size_t length,
+                                  int threadCount) {
+    const unsigned char *data = (const unsigned char *)input;
+    ChunkRun *chunks;
+    MatchResult result;
+    size_t consumed;
+    int i, l, state, started, failed = 0;
+
+    if (threadCount <= 0) {
+        threadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if ((size_t)threadCount > length / CHUNK_MIN_BYTES) {
+        threadCount = (int)(length / CHUNK_MIN_BYTES);
+    }
+#ifdef AUTOMATA_PROFILE
+    /* Speculative lanes would count bytes the real run never takes */
+    if (profileCells(cfsm) != NULL) {
+        threadCount = 1;
+    }
+#endif
+    if (threadCount <= 1 || (chunks = calloc((size_t)threadCount, sizeof(ChunkRun))) == NULL) {
+        return matchCompiledFSM(cfsm, input, length);
+    }
+
+    for (i = 0; i < threadCount; i++) {
+        chunks[i].cfsm = cfsm;
+        chunks[i].data = data;
+        chunks[i].begin = length / threadCount * i;
+        chunks[i].end = i == threadCount - 1 ? length : length / threadCount * (i + 1);
+        chunks[i].lookback = chunks[i].begin > CHUNK_LOOKBACK ?
+                             chunks[i].begin - CHUNK_LOOKBACK : 0;
+    }
+    /* The calling thread runs the first chunk for real; a failed spawn runs later */
+    for (started = 1; started < threadCount; started++) {
+        if (pthread_create(&chunks[started].thread, NULL, runChunkMain, &chunks[started]) != 0) {
+            break;
+        }
+    }
+
+    state = cfsm->initialState;
+    consumed = runTable(cfsm, &state, data, chunks[0].end);
+    failed = consumed < chunks[0].end;
+    for (i = 1; i < threadCount; i++) {
+        if (i < started) {
+            pthread_join(chunks[i].thread, NULL);
+        } else if (!failed && state < cfsm->absorbStart) {
+            runChunkMain(&chunks[i]);
+        }
+        if (failed || state >= cfsm->absorbStart) {
+            continue; /* settled; remaining threads are only joined */
+        }
+        l = chunks[i].gaveUp ? -1 : chunks[i].laneOf[state / cfsm->classCount];
+        if (l < 0) {
+            /* No usable map: run the chunk now that its start state is known */
+            consumed = chunks[i].begin + runTable(cfsm, &state, data + chunks[i].begin,
+                                                  chunks[i].end - chunks[i].begin);
+            failed = consumed < chunks[i].end;
+            continue;
+        }
+        while (chunks[i].parent[l] != l) {
+            l = chunks[i].parent[l];
+        }
+        state = chunks[i].laneState[l];
+        if (chunks[i].laneFail[l] != CHUNK_LIVE) {
+            consumed = chunks[i].laneFail[l];
+            failed = 1;
+        }
+    }
+    for (i = 1; i < threadCount; i++) {
+        freeChunkRun(&chunks[i]);
+    }
+    free(chunks);
+
+    result.failOffset = failed ? (long)consumed : -1;
+    result.finalState = cfsm->fsmStates[state / cfsm->classCount];
+    result.accepted = !failed && COMPILED_ACCEPTING(cfsm, state);
+    return result;
+}
+
+/* Stream Init: start a streaming match at the initial state */
+void streamInit(StreamMatcher *stream, const CompiledFSM *cfsm) {
+    stream->cfsm = cfsm;
+    stream->state = cfsm->initialState;
+    stream->offset = 0;
+    stream->failOffset = -1;
+}
+
+/* Stream Feed: advance over the next chunk without copying it.
+   Returns 0 while the verdict is open, STREAM_SETTLED once an absorbing state
+   accepts whatever follows, -1 once it is rejected; chunks fed after either
+   verdict are counted but not read. */
+int streamFeed(StreamMatcher *stream, const char *chunk, size_t length) {
+    size_t consumed;
+
+    if (stream->failOffset >= 0) {
+        return -1;
+    }
+    if (stream->state >= stream->cfsm->absorbStart) {
+        stream->offset += (long)length;
+        return STREAM_SETTLED;
+    }
+
+    consumed = runTable(stream->cfsm, &stream->state, (const unsigned char *)chunk, length);
+    if (consumed < length) {
+        stream->failOffset = stream->offset + (long)consumed;
+    }
+    stream->offset += (long)length;
+    if (stream->failOffset >= 0) {
+        return -1;
+    }
+    return stream->state >= stream->cfsm->absorbStart ? STREAM_SETTLED : 0;
+}
+
+/* Stream Is Accepting: would the input be accepted if it ended here? */
+int streamIsAccepting(const StreamMatcher *stream) {
+    return stream->failOffset < 0 && COMPILED_ACCEPTING(stream->cfsm, stream->state);
+}
+
+/* Stream Finish: verdict for everything fed so far */
+MatchResult streamFinish(const StreamMatcher *stream) {
+    MatchResult result;
+
+    result.accepted = streamIsAccepting(stream);
+    result.finalState = stream->cfsm->fsmStates[stream->state / stream->cfsm->classCount];
+    result.failOffset = stream->failOffset;
+    return result;
+}
+
+/* Map File: map a whole file read-only for zero-copy matching */
+int mapFile(const char *path, MappedFile *file) {
+    struct stat info;
+    void *data;
+    int fd;
+
+    file->data = NULL;
+    file->length = 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Cannot open '%s'\n", path);
+        return -1;
+    }
+    if (fstat(fd, &info) != 0) {
+        printf("Error: Cannot stat '%s'\n", path);
+        close(fd);
+        return -1;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        return 0; /* empty file: nothing to map */
+    }
+
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Error: Cannot map '%s'\n", path);
+        return -1;
+    }
+    madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+    file->data = data;
+    file->length = (size_t)info.st_size;
+    return 0;
+}
+
+/* Unmap File */
+void unmapFile(MappedFile *file) {
+    if (file->data != NULL) {
+        munmap((void *)file->data, file->length);
+    }
+    file->data = NULL;
+    file->length = 0;
+}
+
+/* Match Mapped File: the whole file as one input */
+MatchResult matchMappedFile(const CompiledFSM *cfsm, const MappedFile *file) {
+    return matchCompiledFSM(cfsm, file->data, file->length);
+}
+
+/* Match Mapped Lines: each '\n'-terminated line (minus a trailing '\r') as one
+   input. Returns the number of accepted lines; onMatch may be NULL. */
+size_t matchMappedLines(const CompiledFSM *cfsm, const MappedFile *file,
+                        LineMatchCallback onMatch, void *context) {
+    const char *line = file->data;
+    const char *end = file->data + file->length;
+    const char *newline;
+    size_t lineNumber = 0, length, matched = 0;
+
+    while (line < end) {
+        newline = memchr(line, '\n', (size_t)(end - line));
+        length = (size_t)((newline != NULL ? newline : end) - line);
+        lineNumber++;
+        if (length > 0 && line[length - 1] == '\r') {
+            length--;
+        }
+        if (runCompiledFSM(cfsm, line, length)) {
+            matched++;
+            if (onMatch != NULL) {
+                onMatch(context, lineNumber, (size_t)(line - file->data), length);
+            }
+        }
+        if (newline == NULL) {
+            break;
+        }
+        line = newline + 1;
+    }
+
+    return matched;
+}
+
+/* Section End: offset just past a section, rounded up to AUTOMATON_ALIGN */
+static unsigned long long sectionEnd(unsigned long long offset, unsigned long long size) {
+    return (offset + size + AUTOMATON_ALIGN - 1) / AUTOMATON_ALIGN * AUTOMATON_ALIGN;
+}
+
+/* Write Section: data at its aligned offset, zero padding up to it */
+static int writeSection(FILE *out, unsigned long long *position, unsigned long long offset,
+                        const void *data, size_t size) {
+    static const char zeros[AUTOMATON_ALIGN];
+
+    while (*position < offset) {
+        size_t pad = offset - *position < sizeof(zeros) ? (size_t)(offset - *position)
+                                                        : sizeof(zeros);
+        if (fwrite(zeros, 1, pad, out) != pad) {
+            return -1;
+        }
+        *position += pad;
+    }
+    if (size > 0 && fwrite(data, 1, size, out) != size) {
+        return -1;
+    }
+    *position += size;
+    return 0;
+}
+
+/* Save Compiled FSM: write cfsm in the binary automaton format */
+int saveCompiledFSM(const CompiledFSM *cfsm, const char *path) {
+    AutomatonHeader header;
+    FILE *out;
+    unsigned long long position = 0;
+    size_t cells = (size_t)cfsm->stateCount * cfsm->classCount;
+    int status = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AUTOMATON_MAGIC, sizeof(header.magic));
+    header.byteOrder = AUTOMATON_BYTE_ORDER;
+    header.version = AUTOMATON_VERSION;
+    header.tableWidth = (unsigned int)cfsm->tableWidth;
+    header.classCount = (unsigned int)cfsm->classCount;
+    header.stateCount = (unsigned int)cfsm->stateCount;
+    header.initialState = (unsigned int)cfsm->initialState;
+    header.acceptStart = (unsigned int)cfsm->acceptStart;
+    header.absorbStart = (unsigned int)cfsm->absorbStart;
+    header.matchIdCount = cfsm->matchStart != NULL ?
+                          (unsigned int)cfsm->matchStart[cfsm->stateCount] : 0;
+
+    header.classMapOffset = sectionEnd(0, sizeof(header));
+    header.tableOffset = sectionEnd(header.classMapOffset, 256);
+    header.fsmStatesOffset = sectionEnd(header.tableOffset, (unsigned long long)cells * cfsm->tableWidth);
+    header.fileSize = sectionEnd(header.fsmStatesOffset,
+                                 (unsigned long long)cfsm->stateCount * sizeof(int));
+    if (header.matchIdCount > 0) {
+        header.matchStartOffset = header.fileSize;
+        header.matchIdsOffset = sectionEnd(header.matchStartOffset,
+                                           ((unsigned long long)cfsm->stateCount + 1) * sizeof(int));
+        header.fileSize = sectionEnd(header.matchIdsOffset,
+                                     (unsigned long long)header.matchIdCount * sizeof(int));
+    }
+
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        printf("Error: Cannot create '%s'\n", path);
+        return -1;
+    }
+    if (writeSection(out, &position, 0, &header, sizeof(header)) != 0 ||
+        writeSection(out, &position, header.classMapOffset, cfsm->classMap, 256) != 0 ||
+        writeSection(out, &position, header.tableOffset, cfsm->table,
+                     cells * cfsm->tableWidth) != 0 ||
+        writeSection(out, &position, header.fsmStatesOffset, cfsm->fsmStates,
+                     (size_t)cfsm->stateCount * sizeof(int)) != 0 ||
+        (header.matchIdCount > 0 &&
+         (writeSection(out, &position, header.matchStartOffset, cfsm->matchStart,
+                       ((size_t)cfsm->stateCount + 1) * sizeof(int)) != 0 ||
+          writeSection(out, &position, header.matchIdsOffset, cfsm->matchIds,
+                       (size_t)header.matchIdCount * sizeof(int)) != 0)) ||
+        writeSection(out, &position, header.fileSize, NULL, 0) != 0) {
+        printf("Error: Cannot write '%s'\n", path);
+        status = -1;
+    }
+    if (fclose(out) != 0 && status == 0) {
+        printf("Error: Cannot write '%s'\n", path);
+        status = -1;
+    }
+    return status;
+}
+
+/* Section Fits: an aligned section of size bytes lies inside the file */
+static int sectionFits(const AutomatonHeader *header, unsigned long long offset,
+                       unsigned long long size) {
+    return offset % AUTOMATON_ALIGN == 0 && offset >= sizeof(AutomatonHeader) &&
+           offset <= header->fileSize && size <= header->fileSize - offset;
+}
+
+/* Load Compiled FSM: map a binary automaton and use it in place. The header and
+   every table entry are checked so a corrupt file cannot send a match out of
+   bounds; nothing is parsed or allocated. */
+int loadCompiledFSM(const char *path, LoadedAutomaton *loaded) {
+    const AutomatonHeader *header;
+    CompiledFSM *cfsm = &loaded->cfsm;
+    unsigned long long cells;
+    size_t i;
+    int entry;
+
+    memset(cfsm, 0, sizeof(*cfsm));
+    if (mapFile(path, &loaded->file) != 0) {
+        return -1;
+    }
+    header = (const AutomatonHeader *)loaded->file.data;
+    if (loaded->file.length < sizeof(AutomatonHeader) ||
+        memcmp(header->magic, AUTOMATON_MAGIC, sizeof(header->magic)) != 0) {
+        printf("Error: '%s' is not a compiled automaton\n", path);
+        unmapFile(&loaded->file);
+        return -1;
+    }
+    if (header->byteOrder != AUTOMATON_BYTE_ORDER || header->version != AUTOMATON_VERSION) {
+        printf("Error: '%s' has an unsupported version or byte order\n", path);
+        unmapFile(&loaded->file);
+        return -1;
+    }
+
+    cells = (unsigned long long)header->stateCount * header->classCount;
+    if (header->fileSize != loaded->file.length ||
+        (header->tableWidth != 1 && header->tableWidth != 2 && header->tableWidth != 4) ||
+        header->classCount == 0 || header->classCount > 256 || header->stateCount == 0 ||
+        cells > 0x7FFFFFFFu || header->initialState >= cells ||
+        header->initialState % header->classCount != 0 ||
+        header->acceptStart > header->absorbStart || header->absorbStart > cells ||
+        header->absorbStart % header->classCount != 0 ||
+        !sectionFits(header, header->classMapOffset, 256) ||
+        !sectionFits(header, header->tableOffset, cells * header->tableWidth) ||
+        !sectionFits(header, header->fsmStatesOffset,
+                     (unsigned long long)header->stateCount * sizeof(int)) ||
+        (header->matchIdCount > 0 &&
+         (!sectionFits(header, header->matchStartOffset,
+                       ((unsigned long long)header->stateCount + 1) * sizeof(int)) ||
+          !sectionFits(header, header->matchIdsOffset,
+                       (unsigned long long)header->matchIdCount * sizeof(int))))) {
+        printf("Error: '%s' is truncated or corrupt\n", path);
+        unmapFile(&loaded->file);
+        return -1;
+    }
+
+    cfsm->table = (void *)(loaded->file.data + header->tableOffset);
+    cfsm->tableWidth = (int)header->tableWidth;
+    cfsm->fsmStates = (int *)(loaded->file.data + header->fsmStatesOffset);
+    memcpy(cfsm->classMap, loaded->file.data + header->classMapOffset, 256);
+    cfsm->classCount = (int)header->classCount;
+    cfsm->stateCount = (int)header->stateCount;
+    cfsm->initialState = (int)header->initialState;
+    cfsm->acceptStart = (int)header->acceptStart;
+    cfsm->absorbStart = (int)header->absorbStart;
+    if (header->matchIdCount > 0) {
+        cfsm->matchStart = (int *)(loaded->file.data + header->matchStartOffset);
+        cfsm->matchIds = (int *)(loaded->file.data + header->matchIdsOffset);
+    }
+
+    for (i = 0; i < 256; i++) {
+        if (cfsm->classMap[i] >= cfsm->classCount) {
+            break;
+        }
+    }
+    for (entry = 0; i == 256 && entry < (int)cells; entry++) {
+        if (compiledEntry(cfsm, (size_t)entry) >= (int)cells ||
+            compiledEntry(cfsm, (size_t)entry) % cfsm->classCount != 0) {
+            break;
+        }
+    }
+    if (i < 256 || entry < (int)cells) {
+        printf("Error: '%s' has out-of-range transitions\n", path);
+        unloadCompiledFSM(loaded);
+        return -1;
+    }
+    if (cfsm->matchStart != NULL) {
+        for (i = 0; i < (size_t)cfsm->stateCount; i++) {
+            if (cfsm->matchStart[i] < 0 || cfsm->matchStart[i] > cfsm->matchStart[i + 1] ||
+                cfsm->matchStart[i + 1] > (int)header->matchIdCount) {
+                printf("Error: '%s' has out-of-range match IDs\n", path);
+                unloadCompiledFSM(loaded);
+                return -1;
+            }
+        }
+    }
+
+    madvise((void *)loaded->file.data, loaded->file.length, MADV_WILLNEED);
+    return 0;
+}
+
+/* Unload Compiled FSM: drop the mapping behind a loaded automaton */
+void unloadCompiledFSM(LoadedAutomaton *loaded) {
+    unmapFile(&loaded->file);
+    memset(&loaded->cfsm, 0, sizeof(loaded->cfsm));
+}
+
+/* Emit Action: the statement a generated matcher runs on entering state */
+static void emitAction(const CompiledFSM *cfsm, int state, FILE *out) {
+    if (state == DEAD_STATE) {
+        fprintf(out, "return 0;\n");
+    } else if (state >= cfsm->absorbStart) {
+        fprintf(out, "return 1;\n");
+    } else {
+        fprintf(out, "goto s%d;\n", state / cfsm->classCount);
+    }
+}
+
+/* Emit FSM Source: write C source for a matcher specialized to dfa, the function
+   int name(const char *input, size_t length), returning 1 iff dfa accepts input.
+   Each state reachable from the initial one becomes a label and a switch on the
+   next byte whose cases jump straight to the next state, so the compiler sees
+   the whole automaton and no table is read at run time. Dead and absorbing
+   states are settled as in compileFSM. Returns -1 on error. */
+int emitFSMSource(const FSM *dfa, const char *name, FILE *out) {
+    CompiledFSM cfsm;
+    int target[256];
+    int *order, *stamp, *tally;
+    int i, b, c, q, t, head, tail, fallback, cases;
+    const char *stateName;
+
+    for (i = 0; name[i] != '\0'; i++) {
+        c = (unsigned char)name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+              (i > 0 && c >= '0' && c <= '9'))) {
+            break;
+        }
+    }
+    if (i == 0 || name[i] != '\0') {
+        printf("Error: '%s' is not a C identifier\n", name);
+        return -1;
+    }
+    if (compileFSM(dfa, &cfsm) != 0) {
+        return -1;
+    }
+    order = malloc((size_t)cfsm.stateCount * sizeof(int));
+    stamp = malloc((size_t)cfsm.stateCount * sizeof(int));
+    tally = malloc((size_t)cfsm.stateCount * sizeof(int));
+    if (order == NULL || stamp == NULL || tally == NULL) {
+        printf("Error: Out of memory generating matcher\n");
+        free(order);
+        free(stamp);
+        free(tally);
+        freeCompiledFSM(&cfsm);
+        return -1;
+    }
+
+    /* Breadth-first from the initial state; absorbing states are inlined */
+    for (q = 0; q < cfsm.stateCount; q++) {
+        stamp[q] = -1;
+    }
+    head = tail = 0;
+    if (cfsm.initialState != DEAD_STATE && cfsm.initialState < cfsm.absorbStart) {
+        stamp[cfsm.initialState / cfsm.classCount] = 0;
+        order[tail++] = cfsm.initialState / cfsm.classCount;
+    }
+    while (head < tail) {
+        q = order[head++];
+        for (c = 0; c < cfsm.classCount; c++) {
+            t = compiledTarget(&cfsm, q, c);
+            if (t != DEAD_STATE && t * cfsm.classCount < cfsm.absorbStart && stamp[t] < 0) {
+                stamp[t] = 0;
+                order[tail++] = t;
+            }
+        }
+    }
+
+    fprintf(out, "/* Generated by emitFSMSource from a %d-state DFA. Do not edit. */\n"
+                 "#include <stddef.h>\n\n"
+                 "int %s(const char *input, size_t length) {\n", tail, name);
+    if (tail == 0) {
+        fprintf(out, "    (void)input;\n    (void)length;\n    return %d;\n}\n",
+                cfsm.initialState != DEAD_STATE);
+    } else {
+        fprintf(out, "    const unsigned char *p = (const unsigned char *)input;\n"
+                     "    const unsigned char *end = p + length;\n\n"
+                     "    goto s%d;\n", order[0]);
+    }
+
+    for (q = 0; q < cfsm.stateCount; q++) {
+        stamp[q] = -1;
+    }
+    for (i = 0; i < tail; i++) {
+        q = order[i];
+        stateName = dfa->stateNames[cfsm.fsmStates[q]];
+        fprintf(out, "\ns%d:", q);
+        if (stateName != NULL && strstr(stateName, "*/") == NULL) {
+            fprintf(out, " /* %s */", stateName);
+        }
+        fprintf(out, "\n    if (p == end) {\n        return %d;\n    }\n"
+                     "    switch (*p++) {\n",
+                COMPILED_ACCEPTING(&cfsm, q * cfsm.classCount));
+
+        /* The most common target becomes the default case */
+        fallback = DEAD_STATE;
+        for (b = 0; b < 256; b++) {
+            target[b] = compiledEntry(&cfsm, (size_t)q * cfsm.classCount + cfsm.classMap[b]);
+            t = target[b] / cfsm.classCount;
+            if (stamp[t] != 2 * i) {
+                stamp[t] = 2 * i;
+                tally[t] = 0;
+            }
+            if (++tally[t] > (b == 0 ? 0 : tally[fallback / cfsm.classCount])) {
+                fallback = target[b];
+            }
+        }
+
+        /* One group of cases per other target, in order of its first byte */
+        for (b = 0; b < 256; b++) {
+            t = target[b] / cfsm.classCount;
+            if (target[b] == fallback || stamp[t] == 2 * i + 1) {
+                continue;
+            }
+            stamp[t] = 2 * i + 1;
+            for (c = b, cases = 0; c < 256; c++) {
+                if (target[c] == target[b]) {
+                    fprintf(out, cases == 0 ? "        case 0x%02x:" :
+                                 cases % 8 == 0 ? "\n        case 0x%02x:" : " case 0x%02x:", c);
+                    cases++;
+                }
+            }
+            fprintf(out, "\n            ");
+            emitAction(&cfsm, target[b], out);
+        }
+        fprintf(out, "        default:\n            ");
+        emitAction(&cfsm, fallback, out);
+        fprintf(out, "    }\n");
+    }
+    if (tail > 0) {
+        fprintf(out, "}\n");
+    }
+
+    free(order);
+    free(stamp);
+    free(tally);
+    freeCompiledFSM(&cfsm);
+    if (ferror(out)) {
+        printf("Error: Cannot write generated matcher\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Print Symbol: printable bytes as-is, others as \xHH */
+static void printSymbol(unsigned char c) {
+    if (c >= 0x20 && c < 0x7F) {
+        printf("%c", c);
+    } else {
+        printf("\\x%02X", c);
+    }
+}
+
+/* Show FSM: visualizeFSM body, annotating states and transitions with their
+   counts when visits/hits are given. Leaves the closing rule to the caller. */
+static void showFSM(const FSM *fsm, const unsigned long long *visits,
+                    const unsigned long long *hits) {
+    int i, j;
+    
+    printf("\n=== FSM Visualization ===\n");
+    
+    /* Display states */
+    printf("States: ");
+    for (i = 0; i < fsm->stateCount; i++) {
+        printf("%s", fsm->stateNames[i]);
+        if (visits != NULL) {
+            printf(" (%llu)", visits[i]);
+        }
+        if (i < fsm->stateCount - 1) {
+            printf(", ");
+        }
+    }
+    printf("\n");
+    
+    /* Display accept states */
+    printf("Accept States: ");
+    for (i = 0; i < fsm->stateCount; i++) {
+        if (fsm->states[i].isAccepting) {
+            printf("%s", fsm->stateNames[i]);
+            for (j = 0; j < fsm->states[i].matchCount; j++) {
+                printf("%c%d", j == 0 ? '[' : ',', fsm->states[i].matchIds[j]);
+            }
+            printf("%s ", fsm->states[i].matchCount > 0 ? "]" : "");
+        }
+    }
+    printf("\n");
+    
+    printf("Initial State: %s\n", fsm->stateNames[fsm->initialState]);
+    
+    /* Display alphabet */
+    printf("Alphabet: {");
+    for (i = 0; i < fsm->alphabetSize; i++) {
+        printSymbol((unsigned char)fsm->alphabet[i]);
+        if (i < fsm->alphabetSize - 1) {
+            printf(", ");
+        }
     }
     printf("}\n");
     
     /* Display transitions */
     printf("\nTransitions:\n");
     for (i = 0; i < fsm->transitionCount; i++) {
-        printf("  %s --%c--> %s\n",
-               fsm->states[fsm->transitions[i].fromState].name,
-               fsm->transitions[i].symbol,
-               fsm->states[fsm->transitions[i].toState].name);
+        printf("  %s --", fsm->stateNames[fsm->transitions[i].fromState]);
+        if (fsm->transitions[i].isEpsilon) {
+            printf("ε");
+        } else {
+            printSymbol((unsigned char)fsm->transitions[i].symbol);
+        }
+        printf("--> %s", fsm->stateNames[fsm->transitions[i].toState]);
+        if (hits != NULL && !fsm->transitions[i].isEpsilon) {
+            printf("  [%llu]", hits[i]);
+        }
+        printf("\n");
+    }
+}
+
+/* Visualize FSM */
+void visualizeFSM(const FSM *fsm) {
+    showFSM(fsm, NULL, NULL);
+    printf("========================\n\n");
+}
+
+/* Visualize FSM Profile: visualizeFSM with visit counts after each state,
+   hit counts after each transition, and the dead-exit totals */
+void visualizeFSMProfile(const FSM *fsm, const ProfileCounts *counts) {
+    showFSM(fsm, counts->stateVisits, counts->transitionHits);
+    printf("\nDead exits: %llu, alphabet rejections: %llu\n", counts->deadExits,
+           counts->alphabetRejections);
+    printf("========================\n\n");
+}
+
+/* Print Trace: render the binary events as text */
+void printTrace(ProcessResult *result) {
+    const TraceEvent *event;
+    const char *const *names = result->fsm->stateNames;
+    int i;
+
+    printf("\n--- Execution Trace ---\n");
+    for (i = 0; i < result->traceCount; i++) {
+        event = &result->trace[i];
+        switch (event->kind) {
+            case TRACE_START:
+                printf("Starting at state: %s\n", names[event->toState]);
+                break;
+            case TRACE_STEP:
+                printf("Read '%c': %s -> %s\n", event->symbol,
+                       names[event->fromState], names[event->toState]);
+                break;
+            case TRACE_NOT_IN_ALPHABET:
+                printf("Error: '%c' not in alphabet\n", event->symbol);
+                break;
+            case TRACE_NO_TRANSITION:
+                printf("No transition for '%c' from %s\n", event->symbol,
+                       names[event->fromState]);
+                break;
+            case TRACE_ACCEPT:
+                printf("✓ String ACCEPTED\n");
+                break;
+            case TRACE_REJECT:
+                printf("✗ String REJECTED\n");
+                break;
+        }
+    }
+}
+
+/* Write Trace Binary: raw TraceEvent records, returns the number written */
+size_t writeTraceBinary(const ProcessResult *result, FILE *out) {
+    return fwrite(result->trace, sizeof(TraceEvent), (size_t)result->traceCount, out);
+}
+
+/* Create Sample FSM */
+void createSampleFSM(FSM *fsm) {
+    int q0, q1, q2;
+    
+    initializeFSM(fsm);
+    
+    /* Add states */
+    q0 = addState(fsm, "q0", 0);
+    q1 = addState(fsm, "q1", 0);
+    q2 = addState(fsm, "q2", 1);
+    
+    /* Add transitions */
+    addTransition(fsm, q0, q1, 'a');
+    addTransition(fsm, q1, q2, 'b');
+    addTransition(fsm, q2, q0, 'c');
+    
+    /* Set initial state */
+    fsm->initialState = q0;
+}
+
+/* State Index Find: state number for an interned name, or the slot to insert it
+   at as -(slot + 1) */
+static int stateIndexFind(const StateIndex *index, const char *name) {
+    unsigned int hash = (unsigned int)((size_t)name >> 4) * 2654435761u;
+    int i, mask = index->capacity - 1;
+
+    for (i = (int)(hash & (unsigned int)mask); index->keys[i] != NULL; i = (i + 1) & mask) {
+        if (index->keys[i] == name) {
+            return index->values[i];
+        }
+    }
+    return -(i + 1);
+}
+
+/* State Index Grow: double the table, keeping the load factor under one half */
+static int stateIndexGrow(StateIndex *index) {
+    StateIndex grown;
+    int i, slot;
+
+    grown.capacity = index->capacity > 0 ? index->capacity * 2 : 1024;
+    grown.count = index->count;
+    grown.keys = calloc((size_t)grown.capacity, sizeof(const char *));
+    grown.values = malloc((size_t)grown.capacity * sizeof(int));
+    if (grown.keys == NULL || grown.values == NULL) {
+        free(grown.keys);
+        free(grown.values);
+        return -1;
+    }
+    for (i = 0; i < index->capacity; i++) {
+        if (index->keys[i] != NULL) {
+            slot = -stateIndexFind(&grown, index->keys[i]) - 1;
+            grown.keys[slot] = index->keys[i];
+            grown.values[slot] = index->values[i];
+        }
+    }
+    free(index->keys);
+    free(index->values);
+    *index = grown;
+    return 0;
+}
+
+/* Resolve State: number of the state called name, added on first use */
+static int resolveState(FSM *fsm, StateIndex *index, const char *name) {
+    const char *interned;
+    int found, state;
+
+    if ((index->count + 1) * 2 > index->capacity && stateIndexGrow(index) != 0) {
+        printf("Error: Out of memory indexing state names\n");
+        return -1;
+    }
+    interned = internName(fsm, name);
+    if (interned == NULL) {
+        printf("Error: Out of memory interning state name\n");
+        return -1;
+    }
+    found = stateIndexFind(index, interned);
+    if (found >= 0) {
+        return found;
+    }
+    state = addState(fsm, interned, 0);
+    if (state >= 0) {
+        index->keys[-found - 1] = interned;
+        index->values[-found - 1] = state;
+        index->count++;
+    }
+    return state;
+}
+
+/* Definition Hex Digit: value of hex digit c, -1 if c is not one */
+static int definitionHexDigit(int c) {
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+           c >= '0' && c <= '9' ? c - '0' : -1;
+}
+
+/* Definition Symbol: one byte of a symbol list, handling \xHH, \n, \t, \r, \s
+   (space) and backslash-escaped literals. Returns -1 at a malformed escape. */
+static int definitionSymbol(const char **pos, const char *end) {
+    const char *p = *pos;
+    int c = (unsigned char)*p++, hi, lo;
+
+    if (c == '\\' && p < end) {
+        c = (unsigned char)*p++;
+        switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 's': c = ' '; break;
+            case 'x':
+                if (end - p < 2) {
+                    return -1;
+                }
+                hi = definitionHexDigit((unsigned char)p[0]);
+                lo = definitionHexDigit((unsigned char)p[1]);
+                if (hi < 0 || lo < 0) {
+                    return -1;
+                }
+                c = hi * 16 + lo;
+                p += 2;
+                break;
+            default:
+                break;
+        }
+    }
+    *pos = p;
+    return c;
+}
+
+/* Definition Code Point: parse "U+" and 1-6 hex digits at *pos, -1 if malformed */
+static long definitionCodePoint(const char **pos, const char *end) {
+    const char *p = *pos;
+    long cp = 0;
+    int digits = 0, d;
+
+    if (end - p < 3 || p[0] != 'U' || p[1] != '+') {
+        return -1;
+    }
+    for (p += 2; p < end && digits < 6; p++, digits++) {
+        d = definitionHexDigit((unsigned char)*p);
+        if (d < 0) {
+            break;
+        }
+        cp = cp * 16 + d;
+    }
+    *pos = p;
+    return digits > 0 ? cp : -1;
+}
+
+/* Definition Token: next whitespace-separated token before lineEnd, stopping at
+   a '#' comment. Returns its length, 0 when the line has no more tokens. */
+static size_t definitionToken(const char **pos, const char *lineEnd, const char **token) {
+    const char *p = *pos;
+
+    while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    if (p == lineEnd || *p == '#') {
+        *pos = lineEnd;
+        return 0;
+    }
+    *token = p;
+    while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+        p++;
+    }
+    *pos = p;
+    return (size_t)(p - *token);
+}
+
+/* Definition State: resolve a name token to its state number, -1 on error */
+static int definitionState(FSM *fsm, StateIndex *index, const char *token, size_t length,
+                           size_t lineNumber) {
+    char name[256];
+
+    if (length >= sizeof(name)) {
+        printf("Error: line %lu: state name too long\n", (unsigned long)lineNumber);
+        return -1;
+    }
+    memcpy(name, token, length);
+    name[length] = '\0';
+    return resolveState(fsm, index, name);
+}
+
+/* Load FSM Text: build an FSM from a line-oriented definition:
+
+       # comment            start NAME           accept NAME...
+       state NAME...        FROM SYMBOLS TO
+
+   SYMBOLS lists bytes and ranges ("a-z0-9_", escapes as in definitionSymbol),
+   is one code point range U+XXXX[-U+YYYY] matched as UTF-8, or is "eps" for
+   an epsilon edge. States are numbered by first appearance;
+   the first one is initial unless a start line names another. */
+int loadFSMText(const char *text, size_t length, FSM *fsm) {
+    StateIndex index;
+    const char *p = text, *end = text + length, *lineEnd, *token[4], *symbols, *symbolsEnd;
+    unsigned char set[32];
+    size_t lineNumber = 0, lines = 1, tokenLength[4];
+    long codePoint, lastCodePoint;
+    int i, directive, c, last, low, high, from, to, status = -1;
+
+    initializeFSM(fsm);
+    index.keys = NULL;
+    index.values = NULL;
+    index.capacity = 0;
+    index.count = 0;
+
+    /* One transition per line up front; symbol lists and U+ ranges grow the array
+       further as they load */
+    for (lineEnd = text; (lineEnd = memchr(lineEnd, '\n', (size_t)(end - lineEnd))) != NULL;
+         lineEnd++) {
+        lines++;
+    }
+    if (reserveFSM(fsm, 16, lines < 0x7FFFFFFF ? (int)lines : 0x7FFFFFFF) != 0) {
+        goto done;
+    }
+
+    for (; p < end; p = lineEnd < end ? lineEnd + 1 : end) {
+        lineNumber++;
+        lineEnd = memchr(p, '\n', (size_t)(end - p));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+        tokenLength[0] = definitionToken(&p, lineEnd, &token[0]);
+        if (tokenLength[0] == 0) {
+            continue;
+        }
+
+        /* Directives: 1 = start, 2 = accept, 3 = state */
+        directive = tokenLength[0] == 5 && memcmp(token[0], "start", 5) == 0 ? 1 :
+                    tokenLength[0] == 6 && memcmp(token[0], "accept", 6) == 0 ? 2 :
+                    tokenLength[0] == 5 && memcmp(token[0], "state", 5) == 0 ? 3 : 0;
+        if (directive != 0) {
+            for (i = 0; (tokenLength[1] = definitionToken(&p, lineEnd, &token[1])) > 0; i++) {
+                from = definitionState(fsm, &index, token[1], tokenLength[1], lineNumber);
+                if (from < 0) {
+                    goto done;
+                }
+                if (directive == 1) {
+                    fsm->initialState = from;
+                } else if (directive == 2) {
+                    fsm->states[from].isAccepting = 1;
+                }
+            }
+            if (i == 0 || (directive == 1 && i > 1)) {
+                printf("Error: line %lu: expected %s\n", (unsigned long)lineNumber,
+                       directive == 1 ? "one state name" : "state names");
+                goto done;
+            }
+            continue;
+        }
+
+        for (i = 1; i < 4; i++) {
+            tokenLength[i] = definitionToken(&p, lineEnd, &token[i]);
+        }
+        if (tokenLength[1] == 0 || tokenLength[2] == 0 || tokenLength[3] != 0) {
+            printf("Error: line %lu: expected FROM SYMBOLS TO\n", (unsigned long)lineNumber);
+            goto done;
+        }
+        from = definitionState(fsm, &index, token[0], tokenLength[0], lineNumber);
+        to = from < 0 ? -1 : definitionState(fsm, &index, token[2], tokenLength[2], lineNumber);
+        if (to < 0) {
+            goto done;
+        }
+
+        if (tokenLength[1] == 3 && memcmp(token[1], "eps", 3) == 0) {
+            addEpsilonTransition(fsm, from, to);
+            continue;
+        }
+        symbols = token[1];
+        symbolsEnd = token[1] + tokenLength[1];
+        if (tokenLength[1] > 2 && memcmp(token[1], "U+", 2) == 0) {
+            codePoint = definitionCodePoint(&symbols, symbolsEnd);
+            lastCodePoint = codePoint;
+            if (codePoint >= 0 && symbols < symbolsEnd && *symbols == '-') {
+                symbols++;
+                lastCodePoint = definitionCodePoint(&symbols, symbolsEnd);
+            }
+            if (codePoint < 0 || lastCodePoint < 0 || symbols != symbolsEnd) {
+                printf("Error: line %lu: bad code point range '%.*s'\n",
+                       (unsigned long)lineNumber, (int)tokenLength[1], token[1]);
+                goto done;
+            }
+            if (addCodePointTransition(fsm, from, to, (unsigned long)codePoint,
+                                       (unsigned long)lastCodePoint) != 0) {
+                goto done;
+            }
+            continue;
+        }
+        memset(set, 0, sizeof(set));
+        low = 256;
+        high = -1;
+        while (symbols < symbolsEnd) {
+            c = definitionSymbol(&symbols, symbolsEnd);
+            last = c;
+            if (c >= 0 && symbols + 1 < symbolsEnd && *symbols == '-') {
+                symbols++;
+                last = definitionSymbol(&symbols, symbolsEnd);
+            }
+            if (c < 0 || last < c) {
+                printf("Error: line %lu: bad symbol list '%.*s'\n", (unsigned long)lineNumber,
+                       (int)tokenLength[1], token[1]);
+                goto done;
+            }
+            low = c < low ? c : low;
+            high = last > high ? last : high;
+            for (; c <= last; c++) {
+                SET_ADD(set, c);
+            }
+        }
+        for (c = low; c <= high; c++) {
+            if (SET_HAS(set, c)) {
+                addTransition(fsm, from, to, (char)c);
+            }
+        }
+    }
+
+    if (fsm->stateCount == 0) {
+        printf("Error: Definition has no states\n");
+        goto done;
+    }
+    status = 0;
+
+done:
+    free(index.keys);
+    free(index.values);
+    if (status != 0) {
+        freeFSM(fsm);
+    }
+    return status;
+}
+
+/* Load FSM File: loadFSMText over a memory-mapped definition file */
+int loadFSMFile(const char *path, FSM *fsm) {
+    MappedFile file;
+    int status;
+
+    if (mapFile(path, &file) != 0) {
+        return -1;
+    }
+    status = loadFSMText(file.data, file.length, fsm);
+    unmapFile(&file);
+    return status;
+}
+
+/* Regex New Node */
+static int rxNewNode(RegexParser *p, int type) {
+    RegexNode *grown;
+    int capacity;
+
+    if (p->nodeCount == p->nodeCapacity) {
+        capacity = p->nodeCapacity > 0 ? p->nodeCapacity * 2 : 32;
+        grown = realloc(p->nodes, (size_t)capacity * sizeof(RegexNode));
+        if (grown == NULL) {
+            p->error = "out of memory";
+            return -1;
+        }
+        p->nodes = grown;
+        p->nodeCapacity = capacity;
+    }
+
+    memset(&p->nodes[p->nodeCount], 0, sizeof(RegexNode));
+    p->nodes[p->nodeCount].type = type;
+    p->nodes[p->nodeCount].left = -1;
+    p->nodes[p->nodeCount].right = -1;
+    return p->nodeCount++;
+}
+
+/* Regex Parse Escape: add the escaped byte(s) after '\' to set.
+   Returns the byte for a single-byte escape, 256 for a shorthand class, -1 on error. */
+static int rxParseEscape(RegexParser *p, unsigned char *set) {
+    int c = (unsigned char)*p->pos;
+    int i, single = -1, negate = 0, hex;
+
+    if (c == '\0') {
+        p->error = "trailing backslash";
+        return -1;
+    }
+    p->pos++;
+
+    switch (c) {
+        case 'n': single = '\n'; break;
+        case 't': single = '\t'; break;
+        case 'r': single = '\r'; break;
+        case 'f': single = '\f'; break;
+        case 'v': single = '\v'; break;
+        case 'x':
+            for (i = 0, single = 0; i < 2; i++, p->pos++) {
+                hex = (unsigned char)*p->pos;
+                if (hex >= '0' && hex <= '9') {
+                    single = single * 16 + hex - '0';
+                } else if ((hex | 0x20) >= 'a' && (hex | 0x20) <= 'f') {
+                    single = single * 16 + (hex | 0x20) - 'a' + 10;
+                } else {
+                    p->error = "invalid \\x escape";
+                    return -1;
+                }
+            }
+            break;
+        case 'D': case 'W': case 'S':
+            negate = 1;
+            c |= 0x20;
+            /* fall through */
+        case 'd': case 'w': case 's':
+            for (i = 0; i < 256; i++) {
+                if (((c == 'd' && i >= '0' && i <= '9') ||
+                     (c == 'w' && (i == '_' || (i >= '0' && i <= '9') ||
+                                   ((i | 0x20) >= 'a' && (i | 0x20) <= 'z'))) ||
+                     (c == 's' && (i == ' ' || (i >= '\t' && i <= '\r')))) != negate) {
+                    SET_ADD(set, i);
+                }
+            }
+            return 256;
+        default:
+            single = c; /* escaped metacharacter or literal */
+            break;
+    }
+
+    SET_ADD(set, single);
+    return single;
+}
+
+/* Regex Parse Class: '[' already consumed */
+static int rxParseClass(RegexParser *p, unsigned char *set) {
+    unsigned char members[32];
+    int negate = 0, first = 1, lo, hi, i;
+
+    memset(members, 0, sizeof(members));
+    if (*p->pos == '^') {
+        negate = 1;
+        p->pos++;
+    }
+
+    while (*p->pos != ']' || first) {
+        if (*p->pos == '\0') {
+            p->error = "missing ']'";
+            return -1;
+        }
+        first = 0;
+
+        if (*p->pos == '\\') {
+            p->pos++;
+            if ((lo = rxParseEscape(p, members)) < 0) {
+                return -1;
+            }
+        } else {
+            lo = (unsigned char)*p->pos++;
+            SET_ADD(members, lo);
+        }
+
+        /* Range a-z, unless '-' is the last character of the class */
+        if (*p->pos == '-' && p->pos[1] != ']' && p->pos[1] != '\0') {
+            p->pos++;
+            if (*p->pos == '\\') {
+                p->pos++;
+                hi = rxParseEscape(p, members);
+            } else {
+                hi = (unsigned char)*p->pos++;
+            }
+            if (lo == 256 || hi < 0 || hi == 256 || hi < lo) {
+                p->error = hi < 0 ? p->error : "invalid class range";
+                return -1;
+            }
+            for (i = lo; i <= hi; i++) {
+                SET_ADD(members, i);
+            }
+        }
+    }
+    p->pos++;
+
+    for (i = 0; i < 32; i++) {
+        set[i] = negate ? (unsigned char)~members[i] : members[i];
+    }
+    return 0;
+}
+
+static int rxParseAlt(RegexParser *p);
+
+/* Regex Parse Atom: literal, '.', class, escape or group */
+static int rxParseAtom(RegexParser *p) {
+    int node, i;
+    char c = *p->pos;
+
+    if (c == '(') {
+        p->pos++;
+        node = rxParseAlt(p);
+        if (node < 0) {
+            return -1;
+        }
+        if (*p->pos != ')') {
+            p->error = "missing ')'";
+            return -1;
+        }
+        p->pos++;
+        return node;
+    }
+
+    if (c == '*' || c == '+' || c == '?' || c == '{') {
+        p->error = "nothing to repeat";
+        return -1;
+    }
+
+    node = rxNewNode(p, RX_SET);
+    if (node < 0) {
+        return -1;
+    }
+
+    p->pos++;
+    if (c == '.') {
+        for (i = 0; i < 256; i++) {
+            if (i != '\n') {
+                SET_ADD(p->nodes[node].set, i);
+            }
+        }
+    } else if (c == '[') {
+        if (rxParseClass(p, p->nodes[node].set) != 0) {
+            return -1;
+        }
+    } else if (c == '\\') {
+        if (rxParseEscape(p, p->nodes[node].set) < 0) {
+            return -1;
+        }
+    } else {
+        SET_ADD(p->nodes[node].set, (unsigned char)c);
+    }
+    return node;
+}
+
+/* Regex Parse Count: decimal repetition bound */
+static int rxParseCount(RegexParser *p) {
+    int value = 0;
+
+    if (*p->pos < '0' || *p->pos > '9') {
+        return -1;
+    }
+    while (*p->pos >= '0' && *p->pos <= '9') {
+        value = value * 10 + (*p->pos++ - '0');
+        if (value > REGEX_MAX_REPEAT) {
+            return -1;
+        }
+    }
+    return value;
+}
+
+/* Regex Parse Repeat: atom followed by any number of *, +, ?, {m,n}.
+   Stacked *, + and ? collapse into one node: ++ is +, ?? is ?, any other pair is *. */
+static int rxParseRepeat(RegexParser *p) {
+    int atom = rxParseAtom(p);
+    int node, min, max, type;
+    char c;
+
+    while (atom >= 0) {
+        c = *p->pos;
+        type = c == '*' ? RX_STAR : c == '+' ? RX_PLUS : RX_QUEST;
+        if ((c == '*' || c == '+' || c == '?') &&
+            (p->nodes[atom].type == RX_STAR || p->nodes[atom].type == RX_PLUS ||
+             p->nodes[atom].type == RX_QUEST)) {
+            p->pos++;
+            if (p->nodes[atom].type != type) {
+                p->nodes[atom].type = RX_STAR;
+            }
+            continue;
+        }
+        if (c == '*' || c == '+' || c == '?') {
+            p->pos++;
+            node = rxNewNode(p, type);
+        } else if (c == '{') {
+            p->pos++;
+            min = rxParseCount(p);
+            max = min;
+            if (*p->pos == ',') {
+                p->pos++;
+                max = *p->pos == '}' ? -1 : rxParseCount(p);
+                if (max == -1 && *p->pos != '}') {
+                    min = -1;
+                }
+            }
+            if (min < 0 || *p->pos != '}' || (max >= 0 && max < min)) {
+                p->error = "invalid repetition";
+                return -1;
+            }
+            p->pos++;
+            node = rxNewNode(p, RX_REPEAT);
+            if (node >= 0) {
+                p->nodes[node].min = min;
+                p->nodes[node].max = max;
+            }
+        } else {
+            break;
+        }
+
+        if (node < 0) {
+            return -1;
+        }
+        p->nodes[node].left = atom;
+        p->nodes[node].height = p->nodes[atom].height + 1;
+        if (p->nodes[node].height > REGEX_MAX_DEPTH) {
+            p->error = "repetitions nested too deeply";
+            return -1;
+        }
+        atom = node;
+    }
+    return atom;
+}
+
+/* Regex Parse Concat: sequence up to '|', ')' or end of pattern */
+static int rxParseConcat(RegexParser *p) {
+    int left = -1, right, node;
+
+    while (*p->pos != '\0' && *p->pos != '|' && *p->pos != ')') {
+        right = rxParseRepeat(p);
+        if (right < 0) {
+            return -1;
+        }
+        if (left < 0) {
+            left = right;
+            continue;
+        }
+        node = rxNewNode(p, RX_CONCAT);
+        if (node < 0) {
+            return -1;
+        }
+        p->nodes[node].left = left;
+        p->nodes[node].right = right;
+        p->nodes[node].height = p->nodes[left].height > p->nodes[right].height ?
+                                p->nodes[left].height : p->nodes[right].height;
+        left = node;
+    }
+
+    return left >= 0 ? left : rxNewNode(p, RX_EMPTY);
+}
+
+/* Regex Parse Alt: concat ('|' concat)* */
+static int rxParseAlt(RegexParser *p) {
+    int left, right, node;
+
+    if (++p->depth > REGEX_MAX_DEPTH) {
+        p->error = "groups nested too deeply";
+        return -1;
+    }
+
+    left = rxParseConcat(p);
+    while (left >= 0 && *p->pos == '|') {
+        p->pos++;
+        right = rxParseConcat(p);
+        if (right < 0) {
+            return -1;
+        }
+        node = rxNewNode(p, RX_ALT);
+        if (node < 0) {
+            return -1;
+        }
+        p->nodes[node].left = left;
+        p->nodes[node].right = right;
+        p->nodes[node].height = p->nodes[left].height > p->nodes[right].height ?
+                                p->nodes[left].height : p->nodes[right].height;
+        left = node;
+    }
+
+    p->depth--;
+    return left;
+}
+
+/* Regex New State */
+static int rxNewState(FSM *nfa) {
+    char name[16];
+
+    if (nfa->stateCount >= REGEX_MAX_STATES) {
+        return -1;
+    }
+    sprintf(name, "r%d", nfa->stateCount);
+    return addState(nfa, name, 0);
+}
+
+/* Regex Emit: Thompson construction of node into nfa, one entry and one exit state.
+   Concatenation and alternation chains are walked iteratively. */
+static int rxEmit(const RegexParser *p, int node, FSM *nfa, int *start, int *end) {
+    const RegexNode *rx = &p->nodes[node];
+    int *chain;
+    int s, e, cs, ce, cur, i, n, k;
+
+    switch (rx->type) {
+        case RX_EMPTY:
+            if ((s = rxNewState(nfa)) < 0) {
+                return -1;
+            }
+            *start = *end = s;
+            return 0;
+
+        case RX_SET:
+            if ((s = rxNewState(nfa)) < 0 || (e = rxNewState(nfa)) < 0) {
+                return -1;
+            }
+            for (i = 0; i < 256; i++) {
+                if (SET_HAS(rx->set, i)) {
+                    addTransition(nfa, s, e, (char)i);
+                }
+            }
+            *start = s;
+            *end = e;
+            return 0;
+
+        case RX_CONCAT:
+        case RX_ALT:
+            /* Flatten the left-deep chain: chain[0] is the leftmost operand */
+            for (n = 1, k = node; p->nodes[k].type == rx->type; k = p->nodes[k].left) {
+                n++;
+            }
+            chain = malloc((size_t)n * sizeof(int));
+            if (chain == NULL) {
+                return -1;
+            }
+            for (i = n - 1, k = node; p->nodes[k].type == rx->type; k = p->nodes[k].left) {
+                chain[i--] = p->nodes[k].right;
+            }
+            chain[0] = k;
+
+            if (rx->type == RX_ALT) {
+                if ((s = rxNewState(nfa)) < 0 || (e = rxNewState(nfa)) < 0) {
+                    free(chain);
+                    return -1;
+                }
+            } else {
+                s = e = -1;
+            }
+            for (i = 0; i < n; i++) {
+                if (rxEmit(p, chain[i], nfa, &cs, &ce) != 0) {
+                    free(chain);
+                    return -1;
+                }
+                if (rx->type == RX_ALT) {
+                    addEpsilonTransition(nfa, s, cs);
+                    addEpsilonTransition(nfa, ce, e);
+                } else {
+                    if (s < 0) {
+                        s = cs;
+                    } else {
+                        addEpsilonTransition(nfa, e, cs);
+                    }
+                    e = ce;
+                }
+            }
+            free(chain);
+            *start = s;
+            *end = e;
+            return 0;
+
+        case RX_STAR:
+        case RX_QUEST:
+            if ((s = rxNewState(nfa)) < 0 || rxEmit(p, rx->left, nfa, &cs, &ce) != 0 ||
+                (e = rxNewState(nfa)) < 0) {
+                return -1;
+            }
+            addEpsilonTransition(nfa, s, cs);
+            addEpsilonTransition(nfa, s, e);
+            addEpsilonTransition(nfa, ce, e);
+            if (rx->type == RX_STAR) {
+                addEpsilonTransition(nfa, ce, cs);
+            }
+            *start = s;
+            *end = e;
+            return 0;
+
+        case RX_PLUS:
+            if (rxEmit(p, rx->left, nfa, &cs, &ce) != 0 || (e = rxNewState(nfa)) < 0) {
+                return -1;
+            }
+            addEpsilonTransition(nfa, ce, cs);
+            addEpsilonTransition(nfa, ce, e);
+            *start = cs;
+            *end = e;
+            return 0;
+
+        case RX_REPEAT:
+            /* x{m,n} = m copies of x, then n - m optional copies (or x* if unbounded) */
+            if ((s = rxNewState(nfa)) < 0) {
+                return -1;
+            }
+            cur = s;
+            n = rx->max < 0 ? rx->min + 1 : rx->max;
+            for (i = 0; i < n; i++) {
+                if (rxEmit(p, rx->left, nfa, &cs, &ce) != 0) {
+                    return -1;
+                }
+                addEpsilonTransition(nfa, cur, cs);
+                if (i >= rx->min) {
+                    if ((e = rxNewState(nfa)) < 0) {
+                        return -1;
+                    }
+                    addEpsilonTransition(nfa, cur, e);
+                    addEpsilonTransition(nfa, ce, e);
+                    if (rx->max < 0) {
+                        addEpsilonTransition(nfa, ce, cs);
+                    }
+                    ce = e;
+                }
+                cur = ce;
+            }
+            *start = s;
+            *end = cur;
+            return 0;
+    }
+
+    return -1;
+}
+
+/* Regex Compile Into: add pattern's Thompson NFA to nfa, returning its entry
+   and exit states */
+static int rxCompileInto(const char *pattern, FSM *nfa, int *start, int *end) {
+    RegexParser parser;
+    int root;
+
+    parser.pattern = pattern;
+    parser.pos = pattern;
+    parser.nodes = NULL;
+    parser.nodeCount = 0;
+    parser.nodeCapacity = 0;
+    parser.depth = 0;
+    parser.error = NULL;
+
+    root = rxParseAlt(&parser);
+    if (root >= 0 && *parser.pos != '\0') {
+        parser.error = "unmatched ')'";
+        root = -1;
+    }
+    if (root < 0) {
+        printf("Error: Invalid regex at offset %d: %s\n",
+               (int)(parser.pos - pattern), parser.error);
+        free(parser.nodes);
+        return -1;
+    }
+
+    if (rxEmit(&parser, root, nfa, start, end) != 0) {
+        printf("Error: Regex too large to compile\n");
+        free(parser.nodes);
+        return -1;
+    }
+
+    free(parser.nodes);
+    return 0;
+}
+
+/* Compile Regex: build a Thompson NFA (with epsilon edges) that accepts exactly
+   the strings matching pattern. Supports | * + ? {m,n} ( ) . [...] and \ escapes. */
+int compileRegex(const char *pattern, FSM *nfa) {
+    int start, end;
+
+    initializeFSM(nfa);
+    if (rxCompileInto(pattern, nfa, &start, &end) != 0) {
+        freeFSM(nfa);
+        return -1;
+    }
+
+    nfa->initialState = start;
+    nfa->states[end].isAccepting = 1;
+    return 0;
+}
+
+/* Build NFA Program: index an NFA's edges by source state, merging symbols
+   that lead to the same target into one bitmap group */
+int buildNFAProgram(const FSM *nfa, NFAProgram *program) {
+    const Transition *tr;
+    int n = nfa->stateCount;
+    int *order = NULL, *cursor = NULL, *groupOf = NULL, *groupOwner = NULL;
+    int i, s, g, groupCount = 0, symbolCount = 0, epsilonCount = 0;
+
+    program->nfa = nfa;
+    program->groupStart = calloc((size_t)n + 1, sizeof(int));
+    program->epsilonStart = calloc((size_t)n + 1, sizeof(int));
+    program->groups = NULL;
+    program->epsilonTargets = NULL;
+    cursor = calloc((size_t)n + 1, sizeof(int));
+    groupOf = malloc(((size_t)n + 1) * sizeof(int));
+    groupOwner = calloc((size_t)n + 1, sizeof(int));
+    if (program->groupStart == NULL || program->epsilonStart == NULL || cursor == NULL ||
+        groupOf == NULL || groupOwner == NULL) {
+        goto outOfMemory;
+    }
+
+    /* Counting sort: epsilon targets and symbol transitions by source state */
+    for (i = 0; i < nfa->transitionCount; i++) {
+        tr = &nfa->transitions[i];
+        if (tr->isEpsilon) {
+            program->epsilonStart[tr->fromState + 1]++;
+            epsilonCount++;
+        } else {
+            cursor[tr->fromState + 1]++;
+            symbolCount++;
+        }
+    }
+    for (s = 0; s < n; s++) {
+        program->epsilonStart[s + 1] += program->epsilonStart[s];
+        cursor[s + 1] += cursor[s];
+    }
+
+    program->epsilonTargets = malloc((size_t)(epsilonCount > 0 ? epsilonCount : 1) * sizeof(int));
+    program->groups = malloc((size_t)(symbolCount > 0 ? symbolCount : 1) * sizeof(NFAEdgeGroup));
+    order = malloc((size_t)(symbolCount > 0 ? symbolCount : 1) * sizeof(int));
+    if (program->epsilonTargets == NULL || program->groups == NULL || order == NULL) {
+        goto outOfMemory;
+    }
+
+    /* groupOwner doubles as the fill cursor for epsilon targets until reset below */
+    for (i = 0; i < nfa->transitionCount; i++) {
+        tr = &nfa->transitions[i];
+        if (tr->isEpsilon) {
+            program->epsilonTargets[program->epsilonStart[tr->fromState] +
+                                    groupOwner[tr->fromState]++] = tr->toState;
+        } else {
+            order[cursor[tr->fromState]++] = i;
+        }
+    }
+    memset(groupOwner, 0, ((size_t)n + 1) * sizeof(int));
+
+    /* cursor[s] now marks the end of state s's slice of order */
+    for (s = 0, i = 0; s < n; s++) {
+        program->groupStart[s] = groupCount;
+        for (; i < cursor[s]; i++) {
+            tr = &nfa->transitions[order[i]];
+            if (groupOwner[tr->toState] == s + 1) {
+                g = groupOf[tr->toState];
+            } else {
+                g = groupCount++;
+                program->groups[g].toState = tr->toState;
+                memset(program->groups[g].symbols, 0, sizeof(program->groups[g].symbols));
+                groupOf[tr->toState] = g;
+                groupOwner[tr->toState] = s + 1;
+            }
+            SET_ADD(program->groups[g].symbols, (unsigned char)tr->symbol);
+        }
+    }
+    program->groupStart[n] = groupCount;
+
+    free(order);
+    free(cursor);
+    free(groupOf);
+    free(groupOwner);
+    return 0;
+
+outOfMemory:
+    printf("Error: Out of memory building NFA program\n");
+    free(order);
+    free(cursor);
+    free(groupOf);
+    free(groupOwner);
+    freeNFAProgram(program);
+    return -1;
+}
+
+/* Free NFA Program */
+void freeNFAProgram(NFAProgram *program) {
+    free(program->groupStart);
+    free(program->groups);
+    free(program->epsilonStart);
+    free(program->epsilonTargets);
+    program->groupStart = NULL;
+    program->groups = NULL;
+    program->epsilonStart = NULL;
+    program->epsilonTargets = NULL;
+}
+
+/* NFA Close: extend list with every state reachable by epsilon edges,
+   using mark[] == generation as the membership test */
+static void nfaClose(const NFAProgram *program, int *list, int *count,
+                     unsigned int *mark, unsigned int generation) {
+    int i, e, target;
+
+    for (i = 0; i < *count; i++) {
+        for (e = program->epsilonStart[list[i]]; e < program->epsilonStart[list[i] + 1]; e++) {
+            target = program->epsilonTargets[e];
+            if (mark[target] != generation) {
+                mark[target] = generation;
+                list[(*count)++] = target;
+            }
+        }
+    }
+}
+
+/* Run NFA Program: Thompson set simulation, O(input * NFA size), no backtracking.
+   Returns 1 if the whole input is accepted, 0 if not, -1 on allocation failure. */
+int runNFAProgram(const NFAProgram *program, const char *input, size_t length) {
+    const FSM *nfa = program->nfa;
+    const NFAEdgeGroup *group;
+    int *current, *next, *swap;
+    unsigned int *mark;
+    unsigned int generation = 1;
+    int currentCount, nextCount, i, g, accepted = 0;
+    size_t pos;
+    unsigned char c;
+
+    current = malloc((size_t)nfa->stateCount * 2 * sizeof(int));
+    mark = calloc((size_t)nfa->stateCount, sizeof(unsigned int));
+    if (current == NULL || mark == NULL) {
+        free(current);
+        free(mark);
+        return -1;
+    }
+    next = current + nfa->stateCount;
+
+    current[0] = nfa->initialState;
+    mark[nfa->initialState] = generation;
+    currentCount = 1;
+    nfaClose(program, current, &currentCount, mark, generation);
+
+    for (pos = 0; pos < length && currentCount > 0; pos++) {
+        c = (unsigned char)input[pos];
+        if (++generation == 0) {
+            memset(mark, 0, (size_t)nfa->stateCount * sizeof(unsigned int));
+            generation = 1;
+        }
+
+        nextCount = 0;
+        for (i = 0; i < currentCount; i++) {
+            for (g = program->groupStart[current[i]]; g < program->groupStart[current[i] + 1]; g++) {
+                group = &program->groups[g];
+                if (SET_HAS(group->symbols, c) && mark[group->toState] != generation) {
+                    mark[group->toState] = generation;
+                    next[nextCount++] = group->toState;
+                }
+            }
+        }
+        nfaClose(program, next, &nextCount, mark, generation);
+
+        swap = current;
+        current = next;
+        next = swap;
+        currentCount = nextCount;
+    }
+
+    for (i = 0; i < currentCount; i++) {
+        if (nfa->states[current[i]].isAccepting) {
+            accepted = 1;
+            break;
+        }
+    }
+
+    free(current < next ? current : next);
+    free(mark);
+    return accepted;
+}
+
+/* Match Regex: does the whole input match pattern?
+   Returns 1 or 0, or -1 if the pattern is invalid. */
+int matchRegex(const char *pattern, const char *input) {
+    FSM nfa;
+    NFAProgram program;
+    int matched;
+
+    if (compileRegex(pattern, &nfa) != 0) {
+        return -1;
+    }
+    if (buildNFAProgram(&nfa, &program) != 0) {
+        freeFSM(&nfa);
+        return -1;
+    }
+
+    matched = runNFAProgram(&program, input, strlen(input));
+    freeNFAProgram(&program);
+    freeFSM(&nfa);
+    return matched;
+}
+
+/* NFA Byte Classes: bytes no edge group tells apart share a class.
+   Fills map and a representative byte per class; returns the class count. */
+static int nfaByteClasses(const NFAProgram *program, unsigned char *map, int *representative) {
+    const NFAEdgeGroup *group;
+    int remap[256][2];
+    int b, g, count = 1, newCount;
+
+    memset(map, 0, 256);
+    for (g = 0; g < program->groupStart[program->nfa->stateCount]; g++) {
+        group = &program->groups[g];
+        memset(remap, -1, sizeof(remap));
+        newCount = 0;
+        for (b = 0; b < 256; b++) {
+            int bit = SET_HAS(group->symbols, b) ? 1 : 0;
+            if (remap[map[b]][bit] < 0) {
+                remap[map[b]][bit] = newCount++;
+            }
+        }
+        if (newCount == count) {
+            continue; /* this group splits nothing */
+        }
+        for (b = 0; b < 256; b++) {
+            map[b] = (unsigned char)remap[map[b]][SET_HAS(group->symbols, b) ? 1 : 0];
+        }
+        count = newCount;
+    }
+
+    for (b = 255; b >= 0; b--) {
+        representative[map[b]] = b;
+    }
+    return count;
+}
+
+/* Set Table Init */
+static int setTableInit(StateSetTable *table, int wordCount, int capacity, int growable) {
+    table->wordCount = wordCount;
+    table->count = 0;
+    table->capacity = capacity;
+    table->growable = growable;
+    table->slotCapacity = 16;
+    while (table->slotCapacity < capacity * 2) {
+        table->slotCapacity *= 2;
+    }
+    table->sets = malloc((size_t)capacity * wordCount * sizeof(unsigned long long));
+    table->slots = calloc((size_t)table->slotCapacity, sizeof(int));
+    if (table->sets == NULL || table->slots == NULL) {
+        free(table->sets);
+        free(table->slots);
+        table->sets = NULL;
+        table->slots = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Set Table Free */
+static void setTableFree(StateSetTable *table) {
+    free(table->sets);
+    free(table->slots);
+    table->sets = NULL;
+    table->slots = NULL;
+    table->count = 0;
+}
+
+/* Set Table Clear: forget every interned set, keeping the storage */
+static void setTableClear(StateSetTable *table) {
+    memset(table->slots, 0, (size_t)table->slotCapacity * sizeof(int));
+    table->count = 0;
+}
+
+/* Hash Set */
+static unsigned long long hashSet(const unsigned long long *set, int wordCount) {
+    unsigned long long hash = 14695981039346656037ull;
+    int i;
+
+    for (i = 0; i < wordCount; i++) {
+        hash = (hash ^ set[i]) * 1099511628211ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+/* Set Table Intern: index of set, inserting it if new.
+   Returns -1 when a fixed-capacity table is full or memory runs out. */
+static int setTableIntern(StateSetTable *table, const unsigned long long *set, int *isNew) {
+    size_t bytes = (size_t)table->wordCount * sizeof(unsigned long long);
+    unsigned long long *sets;
+    int *slots;
+    int i, j, mask, capacity, slotCapacity;
+
+    mask = table->slotCapacity - 1;
+    for (i = (int)(hashSet(set, table->wordCount) & (unsigned long long)mask);
+         table->slots[i] != 0; i = (i + 1) & mask) {
+        if (memcmp(&table->sets[(size_t)(table->slots[i] - 1) * table->wordCount], set, bytes) == 0) {
+            *isNew = 0;
+            return table->slots[i] - 1;
+        }
+    }
+
+    if (table->count == table->capacity) {
+        if (!table->growable) {
+            return -1;
+        }
+        capacity = table->capacity * 2;
+        slotCapacity = table->slotCapacity * 2;
+        sets = realloc(table->sets, (size_t)capacity * bytes);
+        slots = calloc((size_t)slotCapacity, sizeof(int));
+        if (sets == NULL || slots == NULL) {
+            free(slots);
+            if (sets != NULL) {
+                table->sets = sets;
+            }
+            return -1;
+        }
+        for (j = 0; j < table->count; j++) {
+            i = (int)(hashSet(&sets[(size_t)j * table->wordCount], table->wordCount) &
+                      (unsigned long long)(slotCapacity - 1));
+            while (slots[i] != 0) {
+                i = (i + 1) & (slotCapacity - 1);
+            }
+            slots[i] = j + 1;
+        }
+        free(table->slots);
+        table->sets = sets;
+        table->slots = slots;
+        table->capacity = capacity;
+        table->slotCapacity = slotCapacity;
+        mask = slotCapacity - 1;
+        i = (int)(hashSet(set, table->wordCount) & (unsigned long long)mask);
+        while (table->slots[i] != 0) {
+            i = (i + 1) & mask;
+        }
+    }
+
+    memcpy(&table->sets[(size_t)table->count * table->wordCount], set, bytes);
+    table->slots[i] = ++table->count;
+    *isNew = 1;
+    return table->count - 1;
+}
+
+/* Subset Close: epsilon closure of set in place; stack holds the states just added */
+static void subsetClose(const NFAProgram *program, unsigned long long *set,
+                        int *stack, int stackCount) {
+    int state, e, target;
+
+    while (stackCount > 0) {
+        state = stack[--stackCount];
+        for (e = program->epsilonStart[state]; e < program->epsilonStart[state + 1]; e++) {
+            target = program->epsilonTargets[e];
+            if (!(set[target >> 6] & (1ull << (target & 63)))) {
+                set[target >> 6] |= 1ull << (target & 63);
+                stack[stackCount++] = target;
+            }
+        }
+    }
+}
+
+/* Subset Move: closure of the states reachable from set on byte c.
+   Returns 1 if the result is non-empty. */
+static int subsetMove(const NFAProgram *program, const unsigned long long *set, int wordCount,
+                      int c, unsigned long long *to, int *stack) {
+    const NFAEdgeGroup *group;
+    unsigned long long word;
+    int w, state, g, target, stackCount = 0;
+
+    memset(to, 0, (size_t)wordCount * sizeof(unsigned long long));
+    for (w = 0; w < wordCount; w++) {
+        for (word = set[w]; word != 0; word &= word - 1) {
+            state = w * 64 + __builtin_ctzll(word);
+            for (g = program->groupStart[state]; g < program->groupStart[state + 1]; g++) {
+                group = &program->groups[g];
+                target = group->toState;
+                if (SET_HAS(group->symbols, c) && !(to[target >> 6] & (1ull << (target & 63)))) {
+                    to[target >> 6] |= 1ull << (target & 63);
+                    stack[stackCount++] = target;
+                }
+            }
+        }
+    }
+
+    if (stackCount == 0) {
+        return 0;
+    }
+    subsetClose(program, to, stack, stackCount);
+    return 1;
+}
+
+/* Subset Accepting: does set contain an accepting NFA state? */
+static int subsetAccepting(const unsigned long long *set, const unsigned long long *acceptMask,
+                           int wordCount) {
+    int w;
+
+    for (w = 0; w < wordCount; w++) {
+        if (set[w] & acceptMask[w]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Subset Start: epsilon closure of the NFA's initial state, plus its accept mask */
+static void subsetStart(const NFAProgram *program, unsigned long long *startSet,
+                        unsigned long long *acceptMask, int wordCount, int *stack) {
+    const FSM *nfa = program->nfa;
+    int s;
+
+    memset(startSet, 0, (size_t)wordCount * sizeof(unsigned long long));
+    memset(acceptMask, 0, (size_t)wordCount * sizeof(unsigned long long));
+    for (s = 0; s < nfa->stateCount; s++) {
+        if (nfa->states[s].isAccepting) {
+            acceptMask[s >> 6] |= 1ull << (s & 63);
+        }
+    }
+    startSet[nfa->initialState >> 6] |= 1ull << (nfa->initialState & 63);
+    stack[0] = nfa->initialState;
+    subsetClose(program, startSet, stack, 1);
+}
+
+/* Subset Match IDs: sorted, de-duplicated pattern IDs of the accepting NFA
+   states in set, collected into *ids (grown as needed). Returns the count. */
+static int subsetMatchIds(const FSM *nfa, const unsigned long long *set,
+                          const unsigned long long *acceptMask, int wordCount,
+                          int **ids, int *capacity) {
+    const State *state;
+    unsigned long long word;
+    int *grown;
+    int w, i, j, count = 0, key;
+
+    for (w = 0; w < wordCount; w++) {
+        for (word = set[w] & acceptMask[w]; word != 0; word &= word - 1) {
+            state = &nfa->states[w * 64 + __builtin_ctzll(word)];
+            if (count + state->matchCount > *capacity) {
+                grown = realloc(*ids, (size_t)(count + state->matchCount) * 2 * sizeof(int));
+                if (grown == NULL) {
+                    return -1;
+                }
+                *ids = grown;
+                *capacity = (count + state->matchCount) * 2;
+            }
+            if (state->matchCount > 0) {
+                memcpy(*ids + count, state->matchIds, (size_t)state->matchCount * sizeof(int));
+                count += state->matchCount;
+            }
+        }
+    }
+
+    /* Insertion sort: lists are short and mostly sorted already */
+    for (i = 1; i < count; i++) {
+        key = (*ids)[i];
+        for (j = i; j > 0 && (*ids)[j - 1] > key; j--) {
+            (*ids)[j] = (*ids)[j - 1];
+        }
+        (*ids)[j] = key;
+    }
+    for (i = 0, j = 0; i < count; i++) {
+        if (j == 0 || (*ids)[j - 1] != (*ids)[i]) {
+            (*ids)[j++] = (*ids)[i];
+        }
+    }
+    return j;
+}
+
+/* Determinize NFA: subset construction into a DFA FSM (state d0 is initial).
+   Fails if more than maxStates DFA states would be needed (maxStates <= 0: no cap).
+   Each DFA state inherits the union of its NFA states' match IDs. */
+int determinizeNFA(const FSM *nfa, FSM *dfa, int maxStates) {
+    NFAProgram program;
+    StateSetTable table;
+    unsigned char classMap[256];
+    int classRep[256];
+    unsigned long long *current = NULL, *target = NULL, *acceptMask = NULL;
+    int *stack = NULL, *ids = NULL;
+    int wordCount = (nfa->stateCount + 63) / 64;
+    int classCount, d, cls, b, t, isNew, idCount, idCapacity = 0, status = -1;
+    char name[16];
+
+    if (nfa->stateCount == 0) {
+        printf("Error: Cannot determinize an NFA with no states\n");
+        return -1;
+    }
+    if (buildNFAProgram(nfa, &program) != 0) {
+        return -1;
+    }
+    classCount = nfaByteClasses(&program, classMap, classRep);
+
+    initializeFSM(dfa);
+    current = malloc((size_t)wordCount * 3 * sizeof(unsigned long long));
+    stack = malloc((size_t)(nfa->stateCount > 0 ? nfa->stateCount : 1) * sizeof(int));
+    if (current == NULL || stack == NULL || setTableInit(&table, wordCount, 64, 1) != 0) {
+        printf("Error: Out of memory determinizing NFA\n");
+        free(current);
+        free(stack);
+        freeNFAProgram(&program);
+        return -1;
+    }
+    target = current + wordCount;
+    acceptMask = target + wordCount;
+
+    subsetStart(&program, current, acceptMask, wordCount, stack);
+    setTableIntern(&table, current, &isNew);
+    addState(dfa, "d0", subsetAccepting(current, acceptMask, wordCount));
+    idCount = subsetMatchIds(nfa, current, acceptMask, wordCount, &ids, &idCapacity);
+    if (idCount < 0 || setStateMatchIds(dfa, 0, ids, idCount) != 0) {
+        goto done;
+    }
+
+    /* table.count grows as new subsets are discovered */
+    for (d = 0; d < table.count; d++) {
+        memcpy(current, &table.sets[(size_t)d * wordCount], (size_t)wordCount * sizeof(unsigned long long));
+        for (cls = 0; cls < classCount; cls++) {
+            if (!subsetMove(&program, current, wordCount, classRep[cls], target, stack)) {
+                continue;
+            }
+            t = setTableIntern(&table, target, &isNew);
+            if (t < 0) {
+                printf("Error: Out of memory determinizing NFA\n");
+                goto done;
+            }
+            if (isNew) {
+                if (maxStates > 0 && table.count > maxStates) {
+                    printf("Error: DFA exceeds %d states\n", maxStates);
+                    goto done;
+                }
+                sprintf(name, "d%d", t);
+                if (addState(dfa, name, subsetAccepting(target, acceptMask, wordCount)) < 0) {
+                    goto done;
+                }
+                idCount = subsetMatchIds(nfa, target, acceptMask, wordCount, &ids, &idCapacity);
+                if (idCount < 0 || setStateMatchIds(dfa, t, ids, idCount) != 0) {
+                    goto done;
+                }
+            }
+            for (b = 0; b < 256; b++) {
+                if (classMap[b] == cls) {
+                    addTransition(dfa, d, t, (char)b);
+                }
+            }
+        }
+    }
+    dfa->initialState = 0;
+    status = 0;
+
+done:
+    if (status != 0) {
+        freeFSM(dfa);
+    }
+    setTableFree(&table);
+    free(current);
+    free(stack);
+    free(ids);
+    freeNFAProgram(&program);
+    return status;
+}
+
+/* Init Lazy DFA: room for as many cached states as fit in memoryLimit bytes */
+int initLazyDFA(LazyDFA *lazy, const NFAProgram *program, size_t memoryLimit) {
+    int stateCount = program->nfa->stateCount;
+    int wordCount = (stateCount + 63) / 64;
+    size_t perState;
+    int capacity;
+
+    if (stateCount == 0) {
+        printf("Error: Cannot build a lazy DFA for an NFA with no states\n");
+        return -1;
+    }
+    lazy->program = program;
+    lazy->classCount = nfaByteClasses(program, lazy->classMap, lazy->classRep);
+    lazy->startState = -1;
+    lazy->flushCount = 0;
+
+    /* Cached set, transition row, accept flag and two hash slots per state */
+    perState = (size_t)wordCount * sizeof(unsigned long long) +
+               (size_t)lazy->classCount * sizeof(int) + 1 + 2 * sizeof(int);
+    capacity = memoryLimit / perState > 0x3FFFFFFF ? 0x3FFFFFFF : (int)(memoryLimit / perState);
+    if (capacity < 4) {
+        capacity = 4;
+    }
+
+    lazy->next = calloc((size_t)capacity * lazy->classCount, sizeof(int));
+    lazy->accepting = malloc((size_t)capacity);
+    lazy->startSet = malloc((size_t)wordCount * 4 * sizeof(unsigned long long));
+    lazy->stack = malloc((size_t)(stateCount > 0 ? stateCount : 1) * sizeof(int));
+    if (lazy->next == NULL || lazy->accepting == NULL || lazy->startSet == NULL ||
+        lazy->stack == NULL || setTableInit(&lazy->cache, wordCount, capacity, 0) != 0) {
+        printf("Error: Out of memory creating lazy DFA\n");
+        free(lazy->next);
+        free(lazy->accepting);
+        free(lazy->startSet);
+        free(lazy->stack);
+        lazy->next = NULL;
+        lazy->accepting = NULL;
+        lazy->startSet = NULL;
+        lazy->stack = NULL;
+        return -1;
+    }
+    lazy->acceptMask = lazy->startSet + wordCount;
+    lazy->scratch = lazy->acceptMask + wordCount;
+
+    subsetStart(program, lazy->startSet, lazy->acceptMask, wordCount, lazy->stack);
+    return 0;
+}
+
+/* Free Lazy DFA */
+void freeLazyDFA(LazyDFA *lazy) {
+    setTableFree(&lazy->cache);
+    free(lazy->next);
+    free(lazy->accepting);
+    free(lazy->startSet);
+    free(lazy->stack);
+    lazy->next = NULL;
+    lazy->accepting = NULL;
+    lazy->startSet = NULL;
+    lazy->stack = NULL;
+}
+
+/* Lazy Intern: cache index of set (which must not live in the cache).
+   When the cache is full every state is evicted; *keep (if not NULL) names a
+   state that is re-interned first and is updated to its new index. */
+static int lazyIntern(LazyDFA *lazy, const unsigned long long *set, int *keep) {
+    StateSetTable *cache = &lazy->cache;
+    unsigned long long *kept = lazy->scratch + cache->wordCount;
+    size_t bytes = (size_t)cache->wordCount * sizeof(unsigned long long);
+    int index, isNew;
+
+    index = setTableIntern(cache, set, &isNew);
+    if (index < 0) {
+        if (keep != NULL) {
+            memcpy(kept, &cache->sets[(size_t)*keep * cache->wordCount], bytes);
+        }
+        memset(lazy->next, 0, (size_t)cache->count * lazy->classCount * sizeof(int));
+        setTableClear(cache);
+        lazy->startState = -1;
+        lazy->flushCount++;
+
+        if (keep != NULL) {
+            *keep = setTableIntern(cache, kept, &isNew);
+            lazy->accepting[*keep] = (unsigned char)subsetAccepting(kept, lazy->acceptMask,
+                                                                    cache->wordCount);
+        }
+        index = setTableIntern(cache, set, &isNew);
+    }
+
+    if (isNew) {
+        lazy->accepting[index] = (unsigned char)subsetAccepting(set, lazy->acceptMask,
+                                                                cache->wordCount);
+    }
+    return index;
+}
+
+/* Run Lazy DFA: match the whole input, building DFA states only as they are reached.
+   Returns 1 if accepted, 0 if not. */
+int runLazyDFA(LazyDFA *lazy, const char *input, size_t length) {
+    int classCount = lazy->classCount;
+    int state, cls, entry, target;
+    size_t pos;
+
+    if (lazy->startState < 0) {
+        lazy->startState = lazyIntern(lazy, lazy->startSet, NULL);
+    }
+    state = lazy->startState;
+
+    for (pos = 0; pos < length; pos++) {
+        cls = lazy->classMap[(unsigned char)input[pos]];
+        entry = lazy->next[state * classCount + cls];
+
+        if (entry == LAZY_UNKNOWN) {
+            if (!subsetMove(lazy->program, &lazy->cache.sets[(size_t)state * lazy->cache.wordCount],
+                            lazy->cache.wordCount, lazy->classRep[cls], lazy->scratch,
+                            lazy->stack)) {
+                entry = LAZY_DEAD;
+            } else {
+                target = lazyIntern(lazy, lazy->scratch, &state);
+                entry = target + 2;
+            }
+            lazy->next[state * classCount + cls] = entry;
+        }
+
+        if (entry == LAZY_DEAD) {
+            return 0;
+        }
+        state = entry - 2;
+    }
+
+    return lazy->accepting[state];
+}
+
+/* State Signature: hash of a kept state's accept flag and match IDs (sink: plain reject) */
+static unsigned int stateSignature(const FSM *dfa, const int *fsmStates, const int *newToOld,
+                                   int q, int sink) {
+    const State *state;
+    unsigned int hash = 2166136261u;
+    int i;
+
+    if (q == sink) {
+        return hash;
+    }
+    state = &dfa->states[fsmStates[newToOld[q]]];
+    if (!state->isAccepting) {
+        return hash;
+    }
+    hash = (hash ^ 1u) * 16777619u;
+    for (i = 0; i < state->matchCount; i++) {
+        hash = (hash ^ (unsigned int)state->matchIds[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Same Signature: equal accept flag and match IDs */
+static int sameSignature(const FSM *dfa, const int *fsmStates, const int *newToOld,
+                         int q, int r, int sink) {
+    const State *a = q == sink ? NULL : &dfa->states[fsmStates[newToOld[q]]];
+    const State *b = r == sink ? NULL : &dfa->states[fsmStates[newToOld[r]]];
+    int acceptA = a != NULL && a->isAccepting;
+    int acceptB = b != NULL && b->isAccepting;
+
+    if (acceptA != acceptB) {
+        return 0;
+    }
+    if (!acceptA) {
+        return 1;
+    }
+    return a->matchCount == b->matchCount &&
+           (a->matchCount == 0 ||
+            memcmp(a->matchIds, b->matchIds, (size_t)a->matchCount * sizeof(int)) == 0);
+}
+
+/* Minimize FSM: drop unreachable and dead states, then merge equivalent states
+   by Hopcroft partition refinement in O(k n log n) for n states and k symbol
+   classes. States with different match IDs are never merged. States of
+   minimized keep the name of their block's first state. */
+int minimizeFSM(const FSM *dfa, FSM *minimized, MinimizeStats *stats) {
+    CompiledFSM cfsm;
+    int k, n, m, sink, q, p, c, i, j, b, nb, first, marked, size, head, tail;
+    int *next = NULL, *oldToNew = NULL, *newToOld = NULL, *queue = NULL;
+    int *predStart = NULL, *pred = NULL, *elems = NULL, *loc = NULL, *blk = NULL;
+    int *bFirst = NULL, *bEnd = NULL, *bMarked = NULL, *work = NULL, *touched = NULL;
+    int *splitter = NULL, *bucketStart = NULL, *bucket = NULL, *blockOrder = NULL;
+    unsigned char *live = NULL, *predClass = NULL, *inWork = NULL;
+    int *slots = NULL;
+    int blockCount, workCount, touchedCount, splitterSize, slotCapacity, status = -1;
+
+    if (compileTable(dfa, &cfsm, 0) != 0) {
+        return -1;
+    }
+    k = cfsm.classCount;
+    n = cfsm.stateCount; /* compiled states, 0 = dead */
+
+    stats->originalStates = dfa->stateCount;
+    initializeFSM(minimized);
+
+    live = calloc((size_t)n, 1);
+    queue = malloc((size_t)n * sizeof(int));
+    oldToNew = malloc((size_t)n * sizeof(int));
+    newToOld = malloc((size_t)n * sizeof(int));
+    predStart = calloc((size_t)n + 1, sizeof(int));
+    pred = malloc((size_t)n * k * sizeof(int));
+    if (live == NULL || queue == NULL || oldToNew == NULL || newToOld == NULL ||
+        predStart == NULL || pred == NULL) {
+        goto outOfMemory;
+    }
+
+    /* Forward reachability from the initial state (live[] bit 1) */
+    head = tail = 0;
+    live[cfsm.initialState / k] = 1;
+    queue[tail++] = cfsm.initialState / k;
+    while (head < tail) {
+        q = queue[head++];
+        for (c = 0; c < k; c++) {
+            p = compiledTarget(&cfsm, q, c);
+            if (p != DEAD_STATE && !live[p]) {
+                live[p] = 1;
+                queue[tail++] = p;
+            }
+        }
+    }
+    stats->reachableStates = tail;
+
+    /* Backward reachability from accepting states over reachable ones (bit 2) */
+    for (q = 1; q < n; q++) {
+        if (live[q]) {
+            for (c = 0; c < k; c++) {
+                predStart[compiledTarget(&cfsm, q, c) + 1]++;
+            }
+        }
+    }
+    for (q = 0; q < n; q++) {
+        predStart[q + 1] += predStart[q];
+    }
+    memcpy(oldToNew, predStart, (size_t)n * sizeof(int));
+    for (q = 1; q < n; q++) {
+        if (live[q]) {
+            for (c = 0; c < k; c++) {
+                pred[oldToNew[compiledTarget(&cfsm, q, c)]++] = q;
+            }
+        }
+    }
+    head = tail = 0;
+    for (q = 1; q < n; q++) {
+        if (live[q] && COMPILED_ACCEPTING(&cfsm, q * k)) {
+            live[q] |= 2;
+            queue[tail++] = q;
+        }
+    }
+    while (head < tail) {
+        q = queue[head++];
+        for (i = predStart[q]; i < predStart[q + 1]; i++) {
+            if (!(live[pred[i]] & 2)) {
+                live[pred[i]] |= 2;
+                queue[tail++] = pred[i];
+            }
+        }
+    }
+
+    /* Renumber live states 0..m-1; everything else collapses into the sink m */
+    m = 0;
+    for (q = 1; q < n; q++) {
+        if (live[q] == 3) {
+            newToOld[m] = q;
+            oldToNew[q] = m++;
+        } else {
+            oldToNew[q] = -1;
+        }
+    }
+    oldToNew[DEAD_STATE] = -1;
+    sink = m;
+    stats->liveStates = m;
+
+    if (m == 0) {
+        /* Empty language: a single rejecting state, named "dead" if the input has none */
+        addState(minimized, dfa->initialState >= 0 && dfa->initialState < dfa->stateCount ?
+                            dfa->stateNames[dfa->initialState] : "dead", 0);
+        minimized->initialState = 0;
+        stats->minimizedStates = 1;
+        status = 0;
+        goto done;
+    }
+
+    /* Total transition function over the m + 1 kept states */
+    next = malloc((size_t)(m + 1) * k * sizeof(int));
+    if (next == NULL) {
+        goto outOfMemory;
+    }
+    for (q = 0; q <= m; q++) {
+        for (c = 0; c < k; c++) {
+            p = q == sink ? -1 : oldToNew[compiledTarget(&cfsm, newToOld[q], c)];
+            next[q * k + c] = p < 0 ? sink : p;
+        }
+    }
+
+    /* Inverse transitions grouped by target: (predecessor, class) pairs */
+    free(pred);
+    pred = malloc((size_t)(m + 1) * k * sizeof(int));
+    predClass = malloc((size_t)(m + 1) * k);
+    if (pred == NULL || predClass == NULL) {
+        goto outOfMemory;
+    }
+    memset(predStart, 0, ((size_t)m + 2) * sizeof(int));
+    for (i = 0; i < (m + 1) * k; i++) {
+        predStart[next[i] + 1]++;
+    }
+    for (q = 0; q <= m; q++) {
+        predStart[q + 1] += predStart[q];
+    }
+    memcpy(queue, predStart, ((size_t)m + 1) * sizeof(int));
+    for (q = 0; q <= m; q++) {
+        for (c = 0; c < k; c++) {
+            j = queue[next[q * k + c]]++;
+            pred[j] = q;
+            predClass[j] = (unsigned char)c;
+        }
+    }
+
+    /* Partition: elems ordered by block, marked members at the front of each block */
+    elems = malloc((size_t)(m + 1) * sizeof(int));
+    loc = malloc((size_t)(m + 1) * sizeof(int));
+    blk = malloc((size_t)(m + 1) * sizeof(int));
+    bFirst = malloc((size_t)(m + 1) * sizeof(int));
+    bEnd = malloc((size_t)(m + 1) * sizeof(int));
+    bMarked = calloc((size_t)m + 1, sizeof(int));
+    inWork = calloc((size_t)m + 1, 1);
+    work = malloc((size_t)(m + 1) * sizeof(int));
+    touched = malloc((size_t)(m + 1) * sizeof(int));
+    splitter = malloc((size_t)(m + 1) * sizeof(int));
+    bucketStart = malloc(((size_t)k + 1) * sizeof(int));
+    bucket = malloc((size_t)(m + 1) * k * sizeof(int));
+    if (elems == NULL || loc == NULL || blk == NULL || bFirst == NULL || bEnd == NULL ||
+        bMarked == NULL || inWork == NULL || work == NULL || touched == NULL ||
+        splitter == NULL || bucketStart == NULL || bucket == NULL) {
+        goto outOfMemory;
+    }
+
+    /* Initial partition: one block per distinct (accepting, match IDs) signature;
+       the sink shares the plain rejecting block */
+    slotCapacity = 16;
+    while (slotCapacity < 2 * (m + 1)) {
+        slotCapacity *= 2;
+    }
+    slots = calloc((size_t)slotCapacity, sizeof(int));
+    if (slots == NULL) {
+        goto outOfMemory;
+    }
+    blockCount = 0;
+    for (q = 0; q <= m; q++) {
+        i = (int)(stateSignature(dfa, cfsm.fsmStates, newToOld, q, sink) & (unsigned int)(slotCapacity - 1));
+        while (slots[i] != 0 && !sameSignature(dfa, cfsm.fsmStates, newToOld, q, slots[i] - 1, sink)) {
+            i = (i + 1) & (slotCapacity - 1);
+        }
+        if (slots[i] == 0) {
+            slots[i] = q + 1;
+            blk[q] = blockCount;
+            bEnd[blockCount++] = 0;
+        } else {
+            blk[q] = blk[slots[i] - 1];
+        }
+        bEnd[blk[q]]++;
+    }
+    for (b = 0, first = 0; b < blockCount; b++) {
+        bFirst[b] = first;
+        first += bEnd[b];
+        bEnd[b] = bFirst[b];
+    }
+    for (q = 0; q <= m; q++) {
+        loc[q] = bEnd[blk[q]]++;
+        elems[loc[q]] = q;
+    }
+
+    /* Every initial block but the largest is a splitter */
+    for (b = 0, nb = 0; b < blockCount; b++) {
+        if (bEnd[b] - bFirst[b] > bEnd[nb] - bFirst[nb]) {
+            nb = b;
+        }
+    }
+    workCount = 0;
+    for (b = 0; b < blockCount; b++) {
+        if (b != nb) {
+            work[workCount++] = b;
+            inWork[b] = 1;
+        }
+    }
+
+    while (workCount > 0) {
+        b = work[--workCount];
+        inWork[b] = 0;
+        splitterSize = bEnd[b] - bFirst[b];
+        memcpy(splitter, &elems[bFirst[b]], (size_t)splitterSize * sizeof(int));
+
+        /* Bucket the splitter's predecessors by symbol class */
+        memset(bucketStart, 0, ((size_t)k + 1) * sizeof(int));
+        for (i = 0; i < splitterSize; i++) {
+            for (j = predStart[splitter[i]]; j < predStart[splitter[i] + 1]; j++) {
+                bucketStart[predClass[j] + 1]++;
+            }
+        }
+        for (c = 0; c < k; c++) {
+            bucketStart[c + 1] += bucketStart[c];
+        }
+        for (i = 0; i < splitterSize; i++) {
+            for (j = predStart[splitter[i]]; j < predStart[splitter[i] + 1]; j++) {
+                bucket[bucketStart[predClass[j]]++] = pred[j];
+            }
+        }
+        for (c = k; c > 0; c--) {
+            bucketStart[c] = bucketStart[c - 1];
+        }
+        bucketStart[0] = 0;
+
+        for (c = 0; c < k; c++) {
+            /* Mark every state that enters the splitter on class c */
+            touchedCount = 0;
+            for (i = bucketStart[c]; i < bucketStart[c + 1]; i++) {
+                p = bucket[i];
+                nb = blk[p];
+                marked = bFirst[nb] + bMarked[nb];
+                if (loc[p] >= marked) {
+                    q = elems[marked];
+                    elems[marked] = p;
+                    elems[loc[p]] = q;
+                    loc[q] = loc[p];
+                    loc[p] = marked;
+                    if (bMarked[nb]++ == 0) {
+                        touched[touchedCount++] = nb;
+                    }
+                }
+            }
+
+            /* Split each touched block; the smaller half becomes the new block */
+            for (i = 0; i < touchedCount; i++) {
+                b = touched[i];
+                marked = bMarked[b];
+                bMarked[b] = 0;
+                first = bFirst[b];
+                size = bEnd[b] - first;
+                if (marked == size) {
+                    continue;
+                }
+
+                nb = blockCount++;
+                if (marked <= size - marked) {
+                    bFirst[nb] = first;
+                    bEnd[nb] = first + marked;
+                    bFirst[b] = first + marked;
+                } else {
+                    bFirst[nb] = first + marked;
+                    bEnd[nb] = bEnd[b];
+                    bEnd[b] = first + marked;
+                }
+                for (j = bFirst[nb]; j < bEnd[nb]; j++) {
+                    blk[elems[j]] = nb;
+                }
+                /* Whether or not b is pending, queuing the smaller half suffices */
+                work[workCount++] = nb;
+                inWork[nb] = 1;
+            }
+        }
+    }
+
+    /* Emit one state per block except the sink's, numbered in BFS order */
+    blockOrder = malloc((size_t)blockCount * sizeof(int));
+    if (blockOrder == NULL) {
+        goto outOfMemory;
+    }
+    for (b = 0; b < blockCount; b++) {
+        blockOrder[b] = -1;
+    }
+    head = tail = 0;
+    b = blk[oldToNew[cfsm.initialState / k]];
+    blockOrder[b] = tail;
+    queue[tail++] = b;
+    while (head < tail) {
+        b = queue[head++];
+        q = elems[bFirst[b]];
+        for (c = 0; c < k; c++) {
+            nb = blk[next[q * k + c]];
+            if (nb != blk[sink] && blockOrder[nb] < 0) {
+                blockOrder[nb] = tail;
+                queue[tail++] = nb;
+            }
+        }
+    }
+
+    if (reserveFSM(minimized, tail, 0) != 0) {
+        goto done;
+    }
+    for (i = 0; i < tail; i++) {
+        b = queue[i];
+        q = cfsm.fsmStates[newToOld[elems[bFirst[b]]]];
+        for (j = bFirst[b]; j < bEnd[b]; j++) {
+            if (cfsm.fsmStates[newToOld[elems[j]]] < q) {
+                q = cfsm.fsmStates[newToOld[elems[j]]];
+            }
+        }
+        addState(minimized, dfa->stateNames[q], dfa->states[q].isAccepting);
+        setStateMatchIds(minimized, i, dfa->states[q].matchIds, dfa->states[q].matchCount);
+    }
+    for (i = 0; i < tail; i++) {
+        q = elems[bFirst[queue[i]]];
+        for (j = 0; j < dfa->alphabetSize; j++) {
+            c = cfsm.classMap[(unsigned char)dfa->alphabet[j]];
+            nb = blk[next[q * k + c]];
+            if (nb != blk[sink]) {
+                addTransition(minimized, i, blockOrder[nb], dfa->alphabet[j]);
+            }
+        }
+    }
+    minimized->initialState = 0;
+    stats->minimizedStates = tail;
+    status = 0;
+    goto done;
+
+outOfMemory:
+    printf("Error: Out of memory minimizing FSM\n");
+done:
+    if (status != 0) {
+        freeFSM(minimized);
+    }
+    freeCompiledFSM(&cfsm);
+    free(next);
+    free(oldToNew);
+    free(newToOld);
+    free(queue);
+    free(predStart);
+    free(pred);
+    free(predClass);
+    free(live);
+    free(elems);
+    free(loc);
+    free(blk);
+    free(bFirst);
+    free(bEnd);
+    free(bMarked);
+    free(inWork);
+    free(work);
+    free(touched);
+    free(splitter);
+    free(bucketStart);
+    free(bucket);
+    free(blockOrder);
+    free(slots);
+    return status;
+}
+
+/* Compare Heat: most visited first, then by state number */
+static int compareHeat(const void *a, const void *b) {
+    const StateHeat *x = a, *y = b;
+
+    if (x->visits != y->visits) {
+        return x->visits > y->visits ? -1 : 1;
+    }
+    return x->state - y->state;
+}
+
+/* Renumber FSM: equivalent copy of fsm with its states reordered by recorded
+   counts, so compileFSM lays hot states out next to their usual successors.
+   States are chained greedily: begin at the most visited unplaced state and
+   keep following its hottest transition to an unplaced state. compileFSM puts
+   rejecting states before accepting ones, so rejecting states are emitted in
+   reverse chain order and accepting ones in chain order: the hot ends of both
+   groups meet at the boundary. States never reached go to the far ends. */
+int renumberFSM(const FSM *fsm, const ProfileCounts *counts, FSM *reordered) {
+    int n = fsm->stateCount, slots = n > 0 ? n : 1;
+    StateHeat *heat = malloc((size_t)slots * sizeof(StateHeat));
+    int *chain = malloc((size_t)slots * sizeof(int));
+    int *order = malloc((size_t)slots * sizeof(int));
+    int *newIndex = malloc((size_t)slots * sizeof(int));
+    int *edgeStart = calloc((size_t)n + 1, sizeof(int));
+    int *edges = malloc((size_t)(fsm->transitionCount > 0 ? fsm->transitionCount : 1) *
+                        sizeof(int));
+    unsigned long long bestHits;
+    int i, j, q, t, best, chainLength = 0, placed = 0, status = -1;
+
+    initializeFSM(reordered);
+    if (heat == NULL || chain == NULL || order == NULL || newIndex == NULL ||
+        edgeStart == NULL || edges == NULL) {
+        printf("Error: Out of memory renumbering FSM\n");
+        goto done;
+    }
+
+    /* Transitions grouped by source state */
+    for (t = 0; t < fsm->transitionCount; t++) {
+        edgeStart[fsm->transitions[t].fromState + 1]++;
+    }
+    for (q = 0; q < n; q++) {
+        edgeStart[q + 1] += edgeStart[q];
+    }
+    memcpy(order, edgeStart, (size_t)n * sizeof(int));
+    for (t = 0; t < fsm->transitionCount; t++) {
+        edges[order[fsm->transitions[t].fromState]++] = t;
+    }
+
+    for (q = 0; q < n; q++) {
+        heat[q].visits = counts->stateVisits[q];
+        heat[q].state = q;
+        newIndex[q] = -1;
+    }
+    qsort(heat, (size_t)n, sizeof(StateHeat), compareHeat);
+
+    for (i = 0; i < n && heat[i].visits > 0; i++) {
+        for (q = heat[i].state; q >= 0 && newIndex[q] < 0; q = best) {
+            newIndex[q] = chainLength;
+            chain[chainLength++] = q;
+            best = -1;
+            bestHits = 0;
+            for (j = edgeStart[q]; j < edgeStart[q + 1]; j++) {
+                t = edges[j];
+                if (!fsm->transitions[t].isEpsilon && counts->transitionHits[t] > bestHits &&
+                    newIndex[fsm->transitions[t].toState] < 0) {
+                    best = fsm->transitions[t].toState;
+                    bestHits = counts->transitionHits[t];
+                }
+            }
+        }
+    }
+
+    /* Cold rejecting, hot rejecting (reversed), hot accepting, cold accepting */
+    for (q = 0; q < n; q++) {
+        if (newIndex[q] < 0 && !fsm->states[q].isAccepting) {
+            order[placed++] = q;
+        }
+    }
+    for (i = chainLength - 1; i >= 0; i--) {
+        if (!fsm->states[chain[i]].isAccepting) {
+            order[placed++] = chain[i];
+        }
+    }
+    for (i = 0; i < chainLength; i++) {
+        if (fsm->states[chain[i]].isAccepting) {
+            order[placed++] = chain[i];
+        }
+    }
+    for (q = 0; q < n; q++) {
+        if (newIndex[q] < 0 && fsm->states[q].isAccepting) {
+            order[placed++] = q;
+        }
+    }
+
+    if (reserveFSM(reordered, n, fsm->transitionCount) != 0) {
+        goto done;
+    }
+    for (i = 0; i < fsm->alphabetSize; i++) {
+        addToAlphabet(reordered, fsm->alphabet[i]);
+    }
+    for (i = 0; i < n; i++) {
+        q = order[i];
+        newIndex[q] = i;
+        if (addState(reordered, fsm->stateNames[q], fsm->states[q].isAccepting) < 0 ||
+            setStateMatchIds(reordered, i, fsm->states[q].matchIds,
+                             fsm->states[q].matchCount) != 0) {
+            goto done;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        q = order[i];
+        for (j = edgeStart[q]; j < edgeStart[q + 1]; j++) {
+            t = edges[j];
+            if (fsm->transitions[t].isEpsilon) {
+                addEpsilonTransition(reordered, i, newIndex[fsm->transitions[t].toState]);
+            } else {
+                addTransition(reordered, i, newIndex[fsm->transitions[t].toState],
+                              fsm->transitions[t].symbol);
+            }
+        }
+    }
+    reordered->initialState = n > 0 ? newIndex[fsm->initialState] : 0;
+    status = 0;
+
+done:
+    if (status != 0) {
+        freeFSM(reordered);
+    }
+    free(heat);
+    free(chain);
+    free(order);
+    free(newIndex);
+    free(edgeStart);
+    free(edges);
+    return status;
+}
+
+/* Build Pattern Set: union of all patterns' NFAs under one epsilon-linked start
+   state, determinized (at most maxStates states, <= 0 for no cap) and minimized */
+int buildPatternSet(const char *const *patterns, int count, PatternSet *set, int maxStates) {
+    FSM nfa, dfa;
+    MinimizeStats stats;
+    int i, root, start, end;
+
+    initializeFSM(&set->dfa);
+    set->patternCount = count;
+
+    initializeFSM(&nfa);
+    root = addState(&nfa, "u", 0);
+    nfa.initialState = root;
+    for (i = 0; i < count; i++) {
+        if (rxCompileInto(patterns[i], &nfa, &start, &end) != 0) {
+            printf("Error: Pattern %d could not be compiled\n", i);
+            freeFSM(&nfa);
+            return -1;
+        }
+        addEpsilonTransition(&nfa, root, start);
+        if (setStateMatchIds(&nfa, end, &i, 1) != 0) {
+            freeFSM(&nfa);
+            return -1;
+        }
+    }
+
+    if (determinizeNFA(&nfa, &dfa, maxStates) != 0) {
+        freeFSM(&nfa);
+        return -1;
+    }
+    freeFSM(&nfa);
+
+    if (minimizeFSM(&dfa, &set->dfa, &stats) != 0) {
+        freeFSM(&dfa);
+        return -1;
+    }
+    freeFSM(&dfa);
+
+    if (compileFSM(&set->dfa, &set->compiled) != 0) {
+        freeFSM(&set->dfa);
+        return -1;
+    }
+    return 0;
+}
+
+/* Free Pattern Set */
+void freePatternSet(PatternSet *set) {
+    freeCompiledFSM(&set->compiled);
+    freeFSM(&set->dfa);
+    set->patternCount = 0;
+}
+
+/* Match Pattern Set: one pass over input; *ids receives the sorted IDs of every
+   pattern that matches the whole input. Returns how many matched. */
+int matchPatternSet(const PatternSet *set, const char *input, size_t length, const int **ids) {
+    return matchCompiledIds(&set->compiled, input, length, ids);
+}
+
+/* Search Step: advance every thread group of a search DFA state on byte c.
+   Groups are ordered by start offset and own disjoint NFA states (an earlier start
+   shadows a later one in the same state). Once a group accepts, later groups are
+   dropped and no new starts are seeded; until then a fresh group starts at every
+   byte, the implicit self-loop on the start state. Returns the new group count
+   (0: dead) and sets *accepting. */
+static int searchStep(const NFAProgram *program, const unsigned long long *groups, int groupCount,
+                      int matched, int c, const unsigned long long *startSet,
+                      const unsigned long long *acceptMask, int wordCount,
+                      unsigned long long *next, int keyWords, unsigned long long *to,
+                      unsigned long long *claimed, int *stack, int *accepting) {
+    unsigned long long word;
+    int n = program->nfa->stateCount;
+    int g, w, any, count = 0;
+
+    memset(next, 0, (size_t)keyWords * sizeof(unsigned long long));
+    memset(claimed, 0, (size_t)wordCount * sizeof(unsigned long long));
+    *accepting = 0;
+
+    for (g = 0; g <= groupCount && !*accepting; g++) {
+        if (g < groupCount) {
+            if (!subsetMove(program, &groups[(size_t)g * wordCount], wordCount, c, to, stack)) {
+                continue;
+            }
+        } else if (matched) {
+            break;
+        } else {
+            memcpy(to, startSet, (size_t)wordCount * sizeof(unsigned long long));
+        }
+
+        any = 0;
+        for (w = 0; w < wordCount; w++) {
+            to[w] &= ~claimed[w];
+            claimed[w] |= to[w];
+            any |= to[w] != 0;
+        }
+        if (!any) {
+            continue;
+        }
+        count++;
+        for (w = 0; w < wordCount; w++) {
+            for (word = to[w]; word != 0; word &= word - 1) {
+                SEARCH_SET_RANK(next, w * 64 + __builtin_ctzll(word), count);
+            }
+        }
+        *accepting = subsetAccepting(to, acceptMask, wordCount);
+    }
+
+    if (matched || *accepting) {
+        SEARCH_SET_RANK(next, n, 1); /* slot n: a match has been seen */
+    }
+    return count;
+}
+
+/* Build Search DFA: determinize nfa for unanchored leftmost-longest search.
+   A DFA state records which NFA states are live and the start-order rank of the
+   thread group holding each, so the DFA accepts after the end of every candidate
+   match and dies once the leftmost match can grow no longer. */
+static int buildSearchDFA(const FSM *nfa, FSM *dfa, int maxStates) {
+    NFAProgram program;
+    StateSetTable table;
+    unsigned char classMap[256];
+    int classRep[256];
+    unsigned long long *key = NULL, *next = NULL, *sets = NULL, *groups = NULL, *grown;
+    unsigned long long *startSet, *acceptMask, *to, *claimed;
+    int *stack = NULL;
+    int n = nfa->stateCount;
+    int wordCount = (n + 63) / 64, keyWords = (n + 2) / 2;
+    int classCount, d, cls, b, s, r, t, isNew, groupCount, groupCapacity = 0, accepting;
+    int status = -1;
+    char name[16];
+
+    if (n == 0) {
+        printf("Error: Cannot search with an FSM that has no states\n");
+        return -1;
+    }
+    if (buildNFAProgram(nfa, &program) != 0) {
+        return -1;
+    }
+    classCount = nfaByteClasses(&program, classMap, classRep);
+
+    initializeFSM(dfa);
+    key = malloc((size_t)keyWords * 2 * sizeof(unsigned long long));
+    sets = malloc((size_t)wordCount * 4 * sizeof(unsigned long long));
+    stack = malloc((size_t)n * sizeof(int));
+    if (key == NULL || sets == NULL || stack == NULL ||
+        setTableInit(&table, keyWords, 64, 1) != 0) {
+        printf("Error: Out of memory building search DFA\n");
+        free(key);
+        free(sets);
+        free(stack);
+        freeNFAProgram(&program);
+        return -1;
+    }
+    next = key + keyWords;
+    startSet = sets;
+    acceptMask = startSet + wordCount;
+    to = acceptMask + wordCount;
+    claimed = to + wordCount;
+
+    /* Initial state: a single group started at the first byte */
+    subsetStart(&program, startSet, acceptMask, wordCount, stack);
+    groupCount = searchStep(&program, NULL, 0, 0, 0, startSet, acceptMask, wordCount,
+                            next, keyWords, to, claimed, stack, &accepting);
+    setTableIntern(&table, next, &isNew);
+    addState(dfa, "s0", accepting);
+
+    /* table.count grows as new states are discovered */
+    for (d = 0; d < table.count; d++) {
+        memcpy(key, &table.sets[(size_t)d * keyWords], (size_t)keyWords * sizeof(unsigned long long));
+
+        /* Unpack the ranks into one NFA state set per group */
+        groupCount = 0;
+        for (s = 0; s < n; s++) {
+            if (SEARCH_RANK(key, s) > groupCount) {
+                groupCount = SEARCH_RANK(key, s);
+            }
+        }
+        if (groupCount > groupCapacity) {
+            grown = realloc(groups, (size_t)groupCount * wordCount * sizeof(unsigned long long));
+            if (grown == NULL) {
+                printf("Error: Out of memory building search DFA\n");
+                goto done;
+            }
+            groups = grown;
+            groupCapacity = groupCount;
+        }
+        memset(groups, 0, (size_t)groupCount * wordCount * sizeof(unsigned long long));
+        for (s = 0; s < n; s++) {
+            r = SEARCH_RANK(key, s);
+            if (r > 0) {
+                groups[(size_t)(r - 1) * wordCount + (s >> 6)] |= 1ull << (s & 63);
+            }
+        }
+
+        for (cls = 0; cls < classCount; cls++) {
+            if (searchStep(&program, groups, groupCount, SEARCH_RANK(key, n), classRep[cls],
+                           startSet, acceptMask, wordCount, next, keyWords, to, claimed,
+                           stack, &accepting) == 0) {
+                continue; /* every thread died */
+            }
+            t = setTableIntern(&table, next, &isNew);
+            if (t < 0) {
+                printf("Error: Out of memory building search DFA\n");
+                goto done;
+            }
+            if (isNew) {
+                if (maxStates > 0 && table.count > maxStates) {
+                    printf("Error: Search DFA exceeds %d states\n", maxStates);
+                    goto done;
+                }
+                sprintf(name, "s%d", t);
+                if (addState(dfa, name, accepting) < 0) {
+                    goto done;
+                }
+            }
+            for (b = 0; b < 256; b++) {
+                if (classMap[b] == cls) {
+                    addTransition(dfa, d, t, (char)b);
+                }
+            }
+        }
+    }
+    dfa->initialState = 0;
+    status = 0;
+
+done:
+    if (status != 0) {
+        freeFSM(dfa);
+    }
+    setTableFree(&table);
+    free(key);
+    free(sets);
+    free(groups);
+    free(stack);
+    freeNFAProgram(&program);
+    return status;
+}
+
+/* Reverse FSM: every edge flipped; a new initial state has epsilon edges to the
+   old accepting states, and the old initial state is the only accepting one */
+static int reverseFSM(const FSM *fsm, FSM *reversed) {
+    const Transition *t;
+    int i, start;
+    char name[16];
+
+    initializeFSM(reversed);
+    for (i = 0; i < fsm->stateCount; i++) {
+        sprintf(name, "v%d", i);
+        if (addState(reversed, name, i == fsm->initialState) < 0) {
+            freeFSM(reversed);
+            return -1;
+        }
+    }
+    sprintf(name, "v%d", fsm->stateCount);
+    start = addState(reversed, name, 0);
+    if (start < 0) {
+        freeFSM(reversed);
+        return -1;
+    }
+    reversed->initialState = start;
+
+    for (i = 0; i < fsm->transitionCount; i++) {
+        t = &fsm->transitions[i];
+        if (t->isEpsilon) {
+            addEpsilonTransition(reversed, t->toState, t->fromState);
+        } else {
+            addTransition(reversed, t->toState, t->fromState, t->symbol);
+        }
+    }
+    for (i = 0; i < fsm->stateCount; i++) {
+        if (fsm->states[i].isAccepting) {
+            addEpsilonTransition(reversed, start, i);
+        }
+    }
+    return 0;
+}
+
+/* Compile Minimized: minimize a DFA and compile it, consuming the DFA */
+static int compileMinimized(FSM *dfa, CompiledFSM *cfsm) {
+    FSM minimized;
+    MinimizeStats stats;
+    int status;
+
+    status = minimizeFSM(dfa, &minimized, &stats);
+    freeFSM(dfa);
+    if (status != 0) {
+        return -1;
+    }
+    status = compileFSM(&minimized, cfsm);
+    freeFSM(&minimized);
+    return status;
+}
+
+/* Byte Commonness: rough frequency rank of a byte in text and logs, higher = more common */
+static int byteCommonness(unsigned char b) {
+    if (b == ' ' || (b >= 'a' && b <= 'z')) {
+        return 3;
+    }
+    if ((b >= '0' && b <= '9') || b == '\n' || b == '.' || b == ':' || b == '=' || b == '-') {
+        return 2;
+    }
+    if (b >= 0x20 && b < 0x7F) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Build Prefilter: collect the possible first bytes of a match and the literal
+   prefix shared by all matches (none if the empty string matches) */
+static int buildPrefilter(const FSM *fsm, Prefilter *prefilter) {
+    NFAProgram program;
+    const NFAEdgeGroup *group;
+    unsigned long long *set, *acceptMask, *target, word;
+    unsigned char first[32];
+    int *stack;
+    int wordCount = (fsm->stateCount + 63) / 64;
+    int w, g, b, count, last = 0, state;
+
+    memset(prefilter, 0, sizeof(*prefilter));
+    if (buildNFAProgram(fsm, &program) != 0) {
+        return -1;
+    }
+    set = malloc((size_t)wordCount * 3 * sizeof(unsigned long long));
+    stack = malloc((size_t)fsm->stateCount * sizeof(int));
+    if (set == NULL || stack == NULL) {
+        printf("Error: Out of memory building prefilter\n");
+        free(set);
+        free(stack);
+        freeNFAProgram(&program);
+        return -1;
+    }
+    acceptMask = set + wordCount;
+    target = acceptMask + wordCount;
+
+    subsetStart(&program, set, acceptMask, wordCount, stack);
+    while (!subsetAccepting(set, acceptMask, wordCount)) {
+        /* Bytes that lead anywhere from the current set */
+        memset(first, 0, sizeof(first));
+        for (w = 0; w < wordCount; w++) {
+            for (word = set[w]; word != 0; word &= word - 1) {
+                state = w * 64 + __builtin_ctzll(word);
+                for (g = program.groupStart[state]; g < program.groupStart[state + 1]; g++) {
+                    group = &program.groups[g];
+                    for (b = 0; b < 32; b++) {
+                        first[b] |= group->symbols[b];
+                    }
+                }
+            }
+        }
+        count = 0;
+        for (b = 0; b < 256; b++) {
+            if (SET_HAS(first, b)) {
+                last = b;
+                if (prefilter->prefixLength == 0 && count < PREFILTER_MAX_BYTES) {
+                    prefilter->bytes[count] = (unsigned char)b;
+                }
+                count++;
+            }
+        }
+        if (prefilter->prefixLength == 0) {
+            prefilter->byteCount = count <= PREFILTER_MAX_BYTES ? count : 0;
+        }
+        if (count != 1 || prefilter->prefixLength == PREFILTER_MAX_PREFIX) {
+            break;
+        }
+        prefilter->prefix[prefilter->prefixLength++] = (unsigned char)last;
+        subsetMove(&program, set, wordCount, last, target, stack);
+        memcpy(set, target, (size_t)wordCount * sizeof(unsigned long long));
+    }
+
+    for (b = 1; b < prefilter->prefixLength; b++) {
+        if (byteCommonness(prefilter->prefix[b]) <
+            byteCommonness(prefilter->prefix[prefilter->rareOffset])) {
+            prefilter->rareOffset = b;
+        }
+    }
+
+    free(set);
+    free(stack);
+    freeNFAProgram(&program);
+    return 0;
+}
+
+/* Scan Bytes: index of the first byte in data[from .. length) equal to one of
+   bytes[0 .. count), or length if there is none. 16 or 32 bytes per step with
+   SSE2/AVX2 or NEON, scalar (memchr for one byte) elsewhere. */
+static size_t scanBytes(const unsigned char *data, size_t from, size_t length,
+                        const unsigned char *bytes, int count) {
+    size_t i = from;
+    int k;
+
+#if defined(__AVX2__)
+    __m256i needle[PREFILTER_MAX_BYTES], chunk, hits;
+    unsigned int mask;
+
+    for (k = 0; k < count; k++) {
+        needle[k] = _mm256_set1_epi8((char)bytes[k]);
+    }
+    for (; i + 32 <= length; i += 32) {
+        chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        hits = _mm256_cmpeq_epi8(chunk, needle[0]);
+        for (k = 1; k < count; k++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, needle[k]));
+        }
+        mask = (unsigned int)_mm256_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i needle[PREFILTER_MAX_BYTES], chunk, hits;
+    unsigned int mask;
+
+    for (k = 0; k < count; k++) {
+        needle[k] = _mm_set1_epi8((char)bytes[k]);
+    }
+    for (; i + 16 <= length; i += 16) {
+        chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        hits = _mm_cmpeq_epi8(chunk, needle[0]);
+        for (k = 1; k < count; k++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, needle[k]));
+        }
+        mask = (unsigned int)_mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    uint8x16_t needle[PREFILTER_MAX_BYTES], chunk, hits;
+
+    for (k = 0; k < count; k++) {
+        needle[k] = vdupq_n_u8(bytes[k]);
+    }
+    for (; i + 16 <= length; i += 16) {
+        chunk = vld1q_u8(data + i);
+        hits = vceqq_u8(chunk, needle[0]);
+        for (k = 1; k < count; k++) {
+            hits = vorrq_u8(hits, vceqq_u8(chunk, needle[k]));
+        }
+        /* Fold the halves into one lane: vmaxvq_u8 would tie this to AArch64 */
+        if (vget_lane_u64(vreinterpret_u64_u8(vorr_u8(vget_low_u8(hits),
+                                                      vget_high_u8(hits))), 0) != 0) {
+            break; /* the scalar tail below finds the exact byte */
+        }
+    }
+#else
+    const unsigned char *hit;
+
+    if (count == 1) {
+        hit = i < length ? memchr(data + i, bytes[0], length - i) : NULL;
+        return hit != NULL ? (size_t)(hit - data) : length;
+    }
+#endif
+
+    for (; i < length; i++) {
+        for (k = 0; k < count; k++) {
+            if (data[i] == bytes[k]) {
+                return i;
+            }
+        }
+    }
+    return length;
+}
+
+/* Prefilter Next: first offset >= from where a match could start, or length */
+static size_t prefilterNext(const Prefilter *prefilter, const unsigned char *data,
+                            size_t from, size_t length) {
+    size_t hit, start;
+    int offset = prefilter->rareOffset;
+
+    if (prefilter->prefixLength < 2) {
+        return scanBytes(data, from, length, prefilter->bytes, prefilter->byteCount);
+    }
+
+    /* Scan for the prefix's rarest byte, then confirm the whole prefix around it */
+    for (hit = from + offset; hit < length; hit++) {
+        hit = scanBytes(data, hit, length, &prefilter->prefix[offset], 1);
+        if (hit == length) {
+            break;
+        }
+        start = hit - offset;
+        if (start + prefilter->prefixLength > length) {
+            break;
+        }
+        if (memcmp(data + start, prefilter->prefix, (size_t)prefilter->prefixLength) == 0) {
+            return start;
+        }
+    }
+    return length;
+}
+
+/* Compile Searcher: build the forward search and reverse DFAs for fsm (NFA or DFA).
+   Each is capped at maxStates states (<= 0 for no cap). */
+int compileSearcher(const FSM *fsm, Searcher *searcher, int maxStates) {
+    FSM dfa, reversed;
+
+    if (buildSearchDFA(fsm, &dfa, maxStates) != 0 ||
+        compileMinimized(&dfa, &searcher->forward) != 0) {
+        return -1;
+    }
+
+    if (reverseFSM(fsm, &reversed) != 0) {
+        freeCompiledFSM(&searcher->forward);
+        return -1;
+    }
+    if (determinizeNFA(&reversed, &dfa, maxStates) != 0) {
+        freeFSM(&reversed);
+        freeCompiledFSM(&searcher->forward);
+        return -1;
+    }
+    freeFSM(&reversed);
+    if (compileMinimized(&dfa, &searcher->reverse) != 0) {
+        freeCompiledFSM(&searcher->forward);
+        return -1;
+    }
+
+    if (buildPrefilter(fsm, &searcher->prefilter) != 0) {
+        freeSearcher(searcher);
+        return -1;
+    }
+    return 0;
+}
+
+/* Free Searcher */
+void freeSearcher(Searcher *searcher) {
+    freeCompiledFSM(&searcher->forward);
+    freeCompiledFSM(&searcher->reverse);
+}
+
+/* Search From: find the first match in data[from .. length) under mode.
+   The forward DFA finds the end (first accept, or last accept before it dies);
+   the reverse DFA, run back from that end, finds the leftmost start. While no
+   thread is live the prefilter skips ahead to the next possible start. */
+static int searchFrom(const Searcher *searcher, const unsigned char *data, size_t length,
+                      size_t from, SearchMode mode, MatchSpan *span) {
+    const CompiledFSM *forward = &searcher->forward;
+    const CompiledFSM *reverse = &searcher->reverse;
+    int state = forward->initialState, found = COMPILED_ACCEPTING(forward, state);
+    int skip = searcher->prefilter.byteCount > 0;
+    size_t i = from, end = from;
+#ifdef AUTOMATA_PROFILE
+    unsigned long long *hits = profileCells(forward);
+#endif
+
+#define SEARCH_FORWARD_LOOP(type)                                                   \
+    for (; i < length && !(found && mode == SEARCH_EARLIEST); i++) {                \
+        if (skip && state == forward->initialState) {                               \
+            i = prefilterNext(&searcher->prefilter, data, i, length);               \
+            if (i == length) {                                                      \
+                break;                                                              \
+            }                                                                       \
+        }                                                                           \
+        PROFILE_HIT(hits, state + forward->classMap[data[i]]);                      \
+        state = ((const type *)forward->table)[state + forward->classMap[data[i]]]; \
+        if (COMPILED_ACCEPTING(forward, state)) {                                   \
+            found = 1;                                                              \
+            end = i + 1;                                                            \
+            if (state >= forward->absorbStart && mode != SEARCH_EARLIEST) {         \
+                end = length;                                                       \
+                break;                                                              \
+            }                                                                       \
+        } else if (state == DEAD_STATE) {                                           \
+            break;                                                                  \
+        }                                                                           \
+    }
+
+    switch (forward->tableWidth) {
+        case 1:
+            SEARCH_FORWARD_LOOP(unsigned char)
+            break;
+        case 2:
+            SEARCH_FORWARD_LOOP(unsigned short)
+            break;
+        default:
+            SEARCH_FORWARD_LOOP(unsigned int)
+            break;
+    }
+#undef SEARCH_FORWARD_LOOP
+    if (!found) {
+        return 0;
+    }
+
+    span->end = end;
+    span->start = end;
+    state = reverse->initialState;
+    for (i = end; i > from; i--) {
+        state = compiledEntry(reverse, (size_t)state + reverse->classMap[data[i - 1]]);
+        if (COMPILED_ACCEPTING(reverse, state)) {
+            span->start = i - 1;
+        } else if (state == DEAD_STATE) {
+            break;
+        }
+    }
+    return 1;
+}
+
+/* Search First: find one match span anywhere in data in a single forward pass.
+   Returns 1 and fills span if there is a match, 0 otherwise. */
+int searchFirst(const Searcher *searcher, const char *data, size_t length, SearchMode mode,
+                MatchSpan *span) {
+    return searchFrom(searcher, (const unsigned char *)data, length, 0, mode, span);
+}
+
+/* Search All: report every non-overlapping match, left to right, to callback.
+   An empty match advances the search by one byte. Returns the match count. */
+size_t searchAll(const Searcher *searcher, const char *data, size_t length, SearchMode mode,
+                 MatchSpanCallback callback, void *context) {
+    MatchSpan span;
+    size_t from = 0, count = 0;
+
+    while (from <= length &&
+           searchFrom(searcher, (const unsigned char *)data, length, from, mode, &span)) {
+        callback(context, span.start, span.end);
+        count++;
+        from = span.end > span.start ? span.end : span.end + 1;
     }
-    printf("========================\n\n");
+    return count;
 }
 
-/* Print Trace */
-void printTrace(ProcessResult *result) {
+/* Write All: write length bytes to fd, retrying short writes */
+static int writeAll(int fd, const char *data, size_t length) {
+    ssize_t written;
+
+    while (length > 0) {
+        written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/* Parse Request: fill request from one line (without its '\n') */
+static void parseRequest(const MatchServer *server, const char *line, size_t length,
+                         ServeRequest *request) {
+    size_t i = 0;
+    long id = 0;
+
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    for (; i < length && line[i] >= '0' && line[i] <= '9'; i++) {
+        if (id <= server->automatonCount) {
+            id = id * 10 + (line[i] - '0');
+        }
+    }
+    request->input.data = line + i + 1;
+    request->input.length = i < length ? length - i - 1 : 0;
+    if (i == 0 || i >= length || line[i] != ' ') {
+        request->automaton = -1;
+    } else if (id >= server->automatonCount) {
+        request->automaton = -2;
+    } else {
+        request->automaton = (int)id;
+    }
+}
+
+/* Run Requests: match a batch, grouped by automaton with one counting pass so
+   each automaton gets one batch call over its requests */
+static int runRequests(const MatchServer *server, ServeRequest *requests, size_t count,
+                       ServeBatch *batch) {
+    const CompiledFSM *cfsm;
+    size_t i, first;
+    int a;
+
+    if (batch->start == NULL) {
+        batch->start = malloc(((size_t)server->automatonCount + 1) * sizeof(size_t));
+        if (batch->start == NULL) {
+            return -1;
+        }
+    }
+    if (count > batch->capacity) {
+        free(batch->inputs);
+        free(batch->results);
+        free(batch->slot);
+        batch->inputs = malloc(count * sizeof(MatchInput));
+        batch->results = malloc(count * sizeof(BatchResult));
+        batch->slot = malloc(count * sizeof(size_t));
+        batch->capacity = batch->inputs != NULL && batch->results != NULL &&
+                          batch->slot != NULL ? count : 0;
+        if (batch->capacity == 0) {
+            return -1;
+        }
+    }
+
+    /* Counting sort of the matchable requests into per-automaton groups */
+    for (a = 0; a <= server->automatonCount; a++) {
+        batch->start[a] = 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (requests[i].automaton >= 0) {
+            batch->start[requests[i].automaton + 1]++;
+        }
+    }
+    for (a = 0; a < server->automatonCount; a++) {
+        batch->start[a + 1] += batch->start[a];
+    }
+    for (i = 0; i < count; i++) {
+        if (requests[i].automaton >= 0) {
+            batch->slot[i] = batch->start[requests[i].automaton]++;
+            batch->inputs[batch->slot[i]] = requests[i].input;
+        }
+    }
+
+    /* start[a] now ends group a, which begins where group a - 1 ends */
+    for (a = 0, first = 0; a < server->automatonCount; first = batch->start[a++]) {
+        if (batch->start[a] == first) {
+            continue;
+        }
+        cfsm = &server->automata[a].cfsm;
+        if (server->threadCount == 1) {
+            matchBatchInterleaved(cfsm, batch->inputs + first, batch->start[a] - first,
+                                  batch->results + first);
+        } else {
+            matchBatchParallel(cfsm, batch->inputs + first, batch->start[a] - first,
+                               batch->results + first, server->threadCount);
+        }
+    }
+    for (i = 0; i < count; i++) {
+        if (requests[i].automaton >= 0) {
+            requests[i].result = batch->results[batch->slot[i]];
+        }
+    }
+    return 0;
+}
+
+/* Format Responses: render a batch's response lines into out, growing it */
+static size_t formatResponses(const ServeRequest *requests, size_t count, char **out,
+                              size_t *outCapacity) {
+    size_t i, used = 0;
+    char *grown;
+
+    /* "REJECT 2147483646\n" is the longest response line, bar the errors */
+    if (count * 32 > *outCapacity) {
+        grown = realloc(*out, count * 32);
+        if (grown == NULL) {
+            return 0;
+        }
+        *out = grown;
+        *outCapacity = count * 32;
+    }
+    for (i = 0; i < count; i++) {
+        switch (requests[i].automaton) {
+            case -1:
+                used += (size_t)sprintf(*out + used, "ERROR bad request\n");
+                break;
+            case -2:
+                used += (size_t)sprintf(*out + used, "ERROR unknown automaton\n");
+                break;
+            case -3:
+                used += (size_t)sprintf(*out + used, "ERROR request too long\n");
+                break;
+            default:
+                if (requests[i].result.failOffset != BATCH_NO_FAILURE) {
+                    used += (size_t)sprintf(*out + used, "REJECT %u\n",
+                                            (unsigned int)requests[i].result.failOffset);
+                } else {
+                    used += (size_t)sprintf(*out + used, "%s\n",
+                                            requests[i].result.accepted ? "ACCEPT" : "REJECT");
+                }
+                break;
+        }
+    }
+    return used;
+}
+
+/* Serve Stream: answer requests read from inFd on outFd until end of input.
+   Returns 0 at end of input, -1 on a read, write or memory error. */
+int serveStream(const MatchServer *server, int inFd, int outFd) {
+    char *buffer = malloc(SERVE_BUFFER), *out = NULL, *line, *newline;
+    ServeRequest *requests = NULL, *grownRequests;
+    ServeBatch batch = {NULL, NULL, NULL, NULL, 0};
+    size_t fill = 0, count, requestCapacity = 0, outCapacity = 0, used;
+    ssize_t got;
+    int discarding = 0, atEnd = 0, status = -1;
+
+    if (buffer == NULL) {
+        goto done;
+    }
+    while (!atEnd) {
+        got = read(inFd, buffer + fill, SERVE_BUFFER - fill);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            goto done;
+        }
+        atEnd = got == 0;
+        fill += (size_t)got;
+
+        /* Every complete line is a request; at end of input so is a final partial one */
+        count = 0;
+        for (line = buffer; line < buffer + fill; line = newline + 1) {
+            newline = memchr(line, '\n', (size_t)(buffer + fill - line));
+            if (newline == NULL) {
+                if (!atEnd || discarding) {
+                    break;
+                }
+                newline = buffer + fill;
+            }
+            if (count == requestCapacity) {
+                grownRequests = realloc(requests, (count > 0 ? count * 2 : 256) *
+                                                  sizeof(ServeRequest));
+                if (grownRequests == NULL) {
+                    goto done;
+                }
+                requests = grownRequests;
+                requestCapacity = count > 0 ? count * 2 : 256;
+            }
+            if (discarding) {
+                requests[count].automaton = -3; /* tail of an over-long request */
+                discarding = 0;
+            } else {
+                parseRequest(server, line, (size_t)(newline - line), &requests[count]);
+            }
+            count++;
+        }
+
+        if (count > 0) {
+            if (runRequests(server, requests, count, &batch) != 0) {
+                goto done;
+            }
+            used = formatResponses(requests, count, &out, &outCapacity);
+            if (used == 0 || writeAll(outFd, out, used) != 0) {
+                goto done;
+            }
+        }
+
+        /* Keep the partial line; one that fills the buffer is dropped unanswered
+           until its end arrives */
+        fill = line < buffer + fill ? (size_t)(buffer + fill - line) : 0;
+        memmove(buffer, line, fill);
+        if (fill == SERVE_BUFFER) {
+            discarding = 1;
+            fill = 0;
+        }
+    }
+    if (discarding) {
+        used = strlen("ERROR request too long\n");
+        if (writeAll(outFd, "ERROR request too long\n", used) != 0) {
+            goto done;
+        }
+    }
+    status = 0;
+
+done:
+    free(buffer);
+    free(out);
+    free(requests);
+    free(batch.inputs);
+    free(batch.results);
+    free(batch.slot);
+    free(batch.start);
+    return status;
+}
+
+/* Load Server: map every automaton file given to a server */
+int loadServer(MatchServer *server, char **paths, int count, int threadCount) {
+    LoadedAutomaton *automata = calloc((size_t)count, sizeof(LoadedAutomaton));
     int i;
-    printf("\n--- Execution Trace ---\n");
-    for (i = 0; i < result->traceCount; i++) {
-        printf("%s\n", result->trace[i].message);
+
+    if (automata == NULL) {
+        printf("Error: Out of memory loading automata\n");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (loadCompiledFSM(paths[i], &automata[i]) != 0) {
+            while (--i >= 0) {
+                unloadCompiledFSM(&automata[i]);
+            }
+            free(automata);
+            return -1;
+        }
     }
+    server->automata = automata;
+    server->automatonCount = count;
+    server->threadCount = threadCount;
+    return 0;
 }
 
-/* Create Sample FSM */
-void createSampleFSM(FSM *fsm) {
-    int q0, q1, q2;
-    
-    initializeFSM(fsm);
-    
-    /* Add states */
-    q0 = addState(fsm, "q0", 0);
-    q1 = addState(fsm, "q1", 0);
-    q2 = addState(fsm, "q2", 1);
-    
-    /* Add transitions */
-    addTransition(fsm, q0, q1, 'a');
-    addTransition(fsm, q1, q2, 'b');
-    addTransition(fsm, q2, q0, 'c');
-    
-    /* Set initial state */
-    fsm->initialState = q0;
-    fsm->currentState = q0;
+/* Free Server: unmap a server's automata */
+void freeServer(MatchServer *server) {
+    int i;
+
+    for (i = 0; i < server->automatonCount; i++) {
+        unloadCompiledFSM((LoadedAutomaton *)&server->automata[i]);
+    }
+    free((void *)server->automata);
 }
 
-/* Simple Regex Matcher */
-int matchRegex(const char *pattern, const char *input) {
-    /* Simple exact match for demonstration */
-    return strcmp(pattern, input) == 0;
+/* Bench Seconds: monotonic clock reading */
+static double benchSeconds(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
 }
 
 /* Show Menu */
@@ -294,35 +6187,654 @@ void showMenu(void) {
     printf("Select option: ");
 }
 
+/* Command-line front end; AUTOMATA_NO_MAIN drops it so another program
+   (automata_bench.c) can include this file as a library */
+#ifndef AUTOMATA_NO_MAIN
+
+/* Stream Mode: match all of stdin as one input, chunk by chunk */
+static int streamMode(const CompiledFSM *cfsm) {
+    StreamMatcher stream;
+    MatchResult match;
+    char chunk[65536];
+    size_t length;
+
+    streamInit(&stream, cfsm);
+    while ((length = fread(chunk, 1, sizeof(chunk), stdin)) > 0) {
+        if (streamFeed(&stream, chunk, length) != 0) {
+            break; /* accepted or rejected whatever follows: leave the rest unread */
+        }
+    }
+
+    match = streamFinish(&stream);
+    if (match.failOffset >= 0) {
+        printf("REJECTED at offset %ld\n", match.failOffset);
+    } else if (stream.state >= cfsm->absorbStart) {
+        printf("ACCEPTED after %ld bytes, the rest unread\n", stream.offset);
+    } else {
+        printf("%s after %ld bytes\n", match.accepted ? "ACCEPTED" : "REJECTED", stream.offset);
+    }
+    return match.accepted ? 0 : 1;
+}
+
+/* Print Regex Automata: NFA, DFA and minimized DFA sizes for a pattern.
+   Returns -1 if the pattern does not compile. */
+static int printRegexAutomata(const char *pattern) {
+    FSM nfa, dfa, minimized;
+    MinimizeStats stats;
+
+    if (compileRegex(pattern, &nfa) != 0) {
+        return -1;
+    }
+    if (determinizeNFA(&nfa, &dfa, 10000) == 0) {
+        if (minimizeFSM(&dfa, &minimized, &stats) == 0) {
+            printf("Automata: NFA %d states -> DFA %d states -> minimized %d states\n",
+                   nfa.stateCount, stats.originalStates, stats.minimizedStates);
+            freeFSM(&minimized);
+        }
+        freeFSM(&dfa);
+    }
+    freeFSM(&nfa);
+    return 0;
+}
+
+/* Print Line Match: report an accepted line's number and byte offset */
+static void printLineMatch(void *context, size_t lineNumber, size_t offset, size_t length) {
+    (void)context;
+    printf("line %lu offset %lu length %lu\n",
+           (unsigned long)lineNumber, (unsigned long)offset, (unsigned long)length);
+}
+
+/* File Mode: match a memory-mapped file whole or line by line. A whole file is
+   split across threadCount threads (<= 0: every online CPU) unless it is 1. */
+static int fileMode(const CompiledFSM *cfsm, const char *path, int perLine, int threadCount) {
+    MappedFile file;
+    MatchResult match;
+    size_t matched;
+
+    if (mapFile(path, &file) != 0) {
+        return 2;
+    }
+
+    if (perLine) {
+        matched = matchMappedLines(cfsm, &file, printLineMatch, NULL);
+        printf("%lu matching lines\n", (unsigned long)matched);
+        unmapFile(&file);
+        return matched > 0 ? 0 : 1;
+    }
+
+    match = threadCount == 1 ? matchMappedFile(cfsm, &file) :
+            matchCompiledParallel(cfsm, file.data, file.length, threadCount);
+    if (match.failOffset >= 0) {
+        printf("REJECTED at offset %ld\n", match.failOffset);
+    } else {
+        printf("%s (%lu bytes)\n", match.accepted ? "ACCEPTED" : "REJECTED",
+               (unsigned long)file.length);
+    }
+    unmapFile(&file);
+    return match.accepted ? 0 : 1;
+}
+
+/* Print Match Span: report one search match's byte offset and length */
+static void printMatchSpan(void *context, size_t start, size_t end) {
+    (void)context;
+    printf("match offset %lu length %lu\n", (unsigned long)start, (unsigned long)(end - start));
+}
+
+/* Search Mode: report every leftmost-longest match of pattern in a mapped file */
+static int searchMode(const char *pattern, const char *path) {
+    FSM nfa;
+    Searcher searcher;
+    MappedFile file;
+    size_t matched;
+
+    if (compileRegex(pattern, &nfa) != 0) {
+        return 2;
+    }
+    if (compileSearcher(&nfa, &searcher, 10000) != 0) {
+        freeFSM(&nfa);
+        return 2;
+    }
+    freeFSM(&nfa);
+    if (mapFile(path, &file) != 0) {
+        freeSearcher(&searcher);
+        return 2;
+    }
+
+    matched = searchAll(&searcher, file.data, file.length, SEARCH_LEFTMOST_LONGEST,
+                        printMatchSpan, NULL);
+    printf("%lu matches\n", (unsigned long)matched);
+    unmapFile(&file);
+    freeSearcher(&searcher);
+    return matched > 0 ? 0 : 1;
+}
+
+/* Compile Mode: precompile a regex into a binary automaton file */
+static int compileMode(const char *pattern, const char *path) {
+    FSM nfa, dfa;
+    CompiledFSM cfsm;
+    int status;
+
+    if (compileRegex(pattern, &nfa) != 0) {
+        return 2;
+    }
+    status = determinizeNFA(&nfa, &dfa, 100000);
+    freeFSM(&nfa);
+    if (status != 0 || compileMinimized(&dfa, &cfsm) != 0) {
+        return 2;
+    }
+
+    status = saveCompiledFSM(&cfsm, path);
+    if (status == 0) {
+        printf("Wrote %s: %d states, %d classes, %d-byte entries\n", path, cfsm.stateCount,
+               cfsm.classCount, cfsm.tableWidth);
+    }
+    freeCompiledFSM(&cfsm);
+    return status == 0 ? 0 : 2;
+}
+
+/* Load Mode: map a binary automaton and match a file against it line by line */
+static int loadMode(const char *automatonPath, const char *inputPath) {
+    LoadedAutomaton loaded;
+    int status;
+
+    if (loadCompiledFSM(automatonPath, &loaded) != 0) {
+        return 2;
+    }
+    status = fileMode(&loaded.cfsm, inputPath, 1, 1);
+    unloadCompiledFSM(&loaded);
+    return status;
+}
+
+/* Definition Mode: load a text FSM definition, determinize and minimize it,
+   then match a file against it line by line */
+static int definitionMode(const char *definitionPath, const char *inputPath) {
+    FSM fsm, dfa;
+    CompiledFSM cfsm;
+    double start = benchSeconds();
+    int status;
+
+    if (loadFSMFile(definitionPath, &fsm) != 0) {
+        return 2;
+    }
+    printf("Loaded %s: %d states, %d transitions in %.3f s\n", definitionPath, fsm.stateCount,
+           fsm.transitionCount, benchSeconds() - start);
+    status = determinizeNFA(&fsm, &dfa, 100000);
+    freeFSM(&fsm);
+    if (status != 0 || compileMinimized(&dfa, &cfsm) != 0) {
+        return 2;
+    }
+
+    status = fileMode(&cfsm, inputPath, 1, 1);
+    freeCompiledFSM(&cfsm);
+    return status;
+}
+
+/* Emit Mode: determinize and minimize a text FSM definition, then write it as
+   a specialized C matcher function called name */
+static int emitMode(const char *definitionPath, const char *name, const char *outPath) {
+    FSM fsm, dfa, minimized;
+    MinimizeStats stats;
+    FILE *out;
+    int status;
+
+    if (loadFSMFile(definitionPath, &fsm) != 0) {
+        return 2;
+    }
+    status = determinizeNFA(&fsm, &dfa, 100000);
+    freeFSM(&fsm);
+    if (status != 0) {
+        return 2;
+    }
+    status = minimizeFSM(&dfa, &minimized, &stats);
+    freeFSM(&dfa);
+    if (status != 0) {
+        return 2;
+    }
+
+    out = fopen(outPath, "w");
+    if (out == NULL) {
+        printf("Error: Cannot create '%s'\n", outPath);
+        freeFSM(&minimized);
+        return 2;
+    }
+    status = emitFSMSource(&minimized, name, out);
+    if (fclose(out) != 0 && status == 0) {
+        printf("Error: Cannot write '%s'\n", outPath);
+        status = -1;
+    }
+    if (status == 0) {
+        printf("Wrote %s: %s() from %d states\n", outPath, name, stats.minimizedStates);
+    }
+    freeFSM(&minimized);
+    return status == 0 ? 0 : 2;
+}
+
+#ifdef AUTOMATA_PROFILE
+/* Profile Definition: load, determinize and minimize a text FSM definition
+   into *minimized, then match a file's lines against it with the counters
+   attached. Returns the matching line count, or -1. */
+static long profileDefinition(const char *definitionPath, const char *inputPath,
+                              FSM *minimized, ProfileCounts *counts) {
+    FSM fsm, dfa;
+    CompiledFSM cfsm;
+    CompiledProfile profile;
+    MinimizeStats stats;
+    MappedFile file;
+    long matched = -1;
+    int status;
+
+    if (loadFSMFile(definitionPath, &fsm) != 0) {
+        return -1;
+    }
+    status = determinizeNFA(&fsm, &dfa, 100000);
+    freeFSM(&fsm);
+    if (status != 0) {
+        return -1;
+    }
+    status = minimizeFSM(&dfa, minimized, &stats);
+    freeFSM(&dfa);
+    if (status != 0) {
+        return -1;
+    }
+    if (compileFSM(minimized, &cfsm) != 0) {
+        freeFSM(minimized);
+        return -1;
+    }
+    if (mapFile(inputPath, &file) != 0 || initProfile(&profile, &cfsm) != 0) {
+        freeCompiledFSM(&cfsm);
+        freeFSM(minimized);
+        return -1;
+    }
+
+    if (profileAttach(&profile) == 0) {
+        matched = (long)matchMappedLines(&cfsm, &file, NULL, NULL);
+        profileDetach();
+        if (profileCounts(&profile, minimized, counts) != 0) {
+            matched = -1;
+        }
+    }
+    freeProfile(&profile);
+    unmapFile(&file);
+    freeCompiledFSM(&cfsm);
+    if (matched < 0) {
+        freeFSM(minimized);
+    }
+    return matched;
+}
+
+/* Profile Mode: show a definition annotated with the counts from matching a file */
+static int profileMode(const char *definitionPath, const char *inputPath) {
+    FSM minimized;
+    ProfileCounts counts;
+    long matched = profileDefinition(definitionPath, inputPath, &minimized, &counts);
+
+    if (matched < 0) {
+        return 2;
+    }
+    printf("%ld matching lines\n", matched);
+    visualizeFSMProfile(&minimized, &counts);
+    freeProfileCounts(&counts);
+    freeFSM(&minimized);
+    return matched > 0 ? 0 : 1;
+}
+
+/* Reorder Mode: profile a definition on a sample file, renumber its states by
+   the counts and write the result as a binary automaton */
+static int reorderMode(const char *definitionPath, const char *samplePath, const char *outPath) {
+    FSM minimized, reordered;
+    CompiledFSM cfsm;
+    ProfileCounts counts;
+    int status;
+
+    if (profileDefinition(definitionPath, samplePath, &minimized, &counts) < 0) {
+        return 2;
+    }
+    status = renumberFSM(&minimized, &counts, &reordered);
+    freeProfileCounts(&counts);
+    freeFSM(&minimized);
+    if (status != 0) {
+        return 2;
+    }
+    status = compileFSM(&reordered, &cfsm);
+    freeFSM(&reordered);
+    if (status != 0) {
+        return 2;
+    }
+
+    status = saveCompiledFSM(&cfsm, outPath);
+    if (status == 0) {
+        printf("Wrote %s: %d states, %d classes, %d-byte entries\n", outPath, cfsm.stateCount,
+               cfsm.classCount, cfsm.tableWidth);
+    }
+    freeCompiledFSM(&cfsm);
+    return status == 0 ? 0 : 2;
+}
+#endif
+
+/* Bench Mode: single-stream matchBatch against matchBatchInterleaved on count
+   short random strings, using a DFA large enough to spill out of L1 */
+static int benchMode(long count) {
+    const char *pattern = "(a|b)*a(a|b){12}";
+    FSM nfa, dfa;
+    CompiledFSM cfsm;
+    MatchInput *inputs;
+    BatchResult *single, *interleaved;
+    char *buffer;
+    size_t i, j, total = 0, acceptedSingle = 0, acceptedInterleaved = 0;
+    unsigned int seed = 12345;
+    double elapsed, bestSingle = 1e30, bestInterleaved = 1e30;
+    int round, status = 1;
+
+    if (count <= 0 || compileRegex(pattern, &nfa) != 0) {
+        return 2;
+    }
+    if (determinizeNFA(&nfa, &dfa, 100000) != 0) {
+        freeFSM(&nfa);
+        return 2;
+    }
+    freeFSM(&nfa);
+    if (compileMinimized(&dfa, &cfsm) != 0) {
+        return 2;
+    }
+
+    inputs = malloc((size_t)count * sizeof(MatchInput));
+    single = malloc((size_t)count * sizeof(BatchResult));
+    interleaved = malloc((size_t)count * sizeof(BatchResult));
+    buffer = malloc((size_t)count * 80);
+    if (inputs == NULL || single == NULL || interleaved == NULL || buffer == NULL) {
+        printf("Error: Out of memory for benchmark inputs\n");
+        goto done;
+    }
+
+    /* 16..79 bytes of a/b, with the odd foreign byte so some inputs die early */
+    for (i = 0; i < (size_t)count; i++) {
+        inputs[i].data = buffer + total;
+        seed = seed * 1103515245u + 12345u;
+        inputs[i].length = 16 + (seed >> 16) % 64;
+        for (j = 0; j < inputs[i].length; j++) {
+            seed = seed * 1103515245u + 12345u;
+            buffer[total++] = (seed >> 16) % 500 == 0 ? 'c' : ((seed >> 20) & 1 ? 'a' : 'b');
+        }
+    }
+
+    for (round = 0; round < 5; round++) {
+        elapsed = benchSeconds();
+        acceptedSingle = matchBatch(&cfsm, inputs, (size_t)count, single);
+        elapsed = benchSeconds() - elapsed;
+        bestSingle = elapsed < bestSingle ? elapsed : bestSingle;
+        elapsed = benchSeconds();
+        acceptedInterleaved = matchBatchInterleaved(&cfsm, inputs, (size_t)count, interleaved);
+        elapsed = benchSeconds() - elapsed;
+        bestInterleaved = elapsed < bestInterleaved ? elapsed : bestInterleaved;
+    }
+    for (i = 0; i < (size_t)count; i++) {
+        if (single[i].accepted != interleaved[i].accepted ||
+            single[i].failOffset != interleaved[i].failOffset) {
+            printf("Error: Kernels disagree on input %lu\n", (unsigned long)i);
+            goto done;
+        }
+    }
+
+    printf("Pattern %s: %d DFA states, %ld inputs, %lu bytes, %lu accepted\n", pattern,
+           cfsm.stateCount, count, (unsigned long)total, (unsigned long)acceptedSingle);
+    printf("single-stream: %8.1f MB/s\n", (double)total / bestSingle / 1e6);
+    printf("interleaved x%d: %6.1f MB/s (%.2fx)\n", INTERLEAVE_LANES,
+           (double)total / bestInterleaved / 1e6, bestSingle / bestInterleaved);
+    status = acceptedSingle == acceptedInterleaved ? 0 : 1;
+
+done:
+    free(inputs);
+    free(single);
+    free(interleaved);
+    free(buffer);
+    freeCompiledFSM(&cfsm);
+    return status;
+}
+
+/* Connection Count: live TCP connections, drained before the automata are unloaded */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    int active;
+} ConnectionCount;
+
+/* Serve Connection: one accepted client, handed to its thread */
+typedef struct {
+    const MatchServer *server;
+    ConnectionCount *live;
+    int fd;
+} ServeConnection;
+
+/* Serve Connection Main: one TCP client, served on its own thread */
+static void *serveConnectionMain(void *arg) {
+    ServeConnection *connection = arg;
+    ConnectionCount *live = connection->live;
+
+    serveStream(connection->server, connection->fd, connection->fd);
+    close(connection->fd);
+    free(connection);
+
+    pthread_mutex_lock(&live->lock);
+    if (--live->active == 0) {
+        pthread_cond_signal(&live->drained);
+    }
+    pthread_mutex_unlock(&live->lock);
+    return NULL;
+}
+
+/* Serve Mode: answer requests on stdin with responses on stdout, batches
+   spread over every core */
+static int serveMode(char **paths, int count) {
+    MatchServer server;
+    int status;
+
+    if (loadServer(&server, paths, count, 0) != 0) {
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Serving %d automata on stdin\n", count);
+    status = serveStream(&server, STDIN_FILENO, STDOUT_FILENO);
+    freeServer(&server);
+    return status == 0 ? 0 : 2;
+}
+
+/* Serve TCP Mode: accept clients on 127.0.0.1:port, one thread per connection
+   running the interleaved kernel over its own batches. Running out of file
+   descriptors or memory only pauses accepting; on a hard accept error the
+   automata are unloaded once every connection has finished. */
+static int serveTcpMode(int port, char **paths, int count) {
+    MatchServer server;
+    ConnectionCount live;
+    ServeConnection *connection;
+    struct sockaddr_in address;
+    struct timespec backoff;
+    pthread_t thread;
+    int listener, fd, yes = 1;
+
+    if (port <= 0 || port > 65535) {
+        printf("Error: Bad port %d\n", port);
+        return 2;
+    }
+    if (loadServer(&server, paths, count, 1) != 0) {
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0 ||
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) != 0 ||
+        bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, SERVE_LISTEN_BACKLOG) != 0) {
+        printf("Error: Cannot listen on port %d\n", port);
+        if (listener >= 0) {
+            close(listener);
+        }
+        freeServer(&server);
+        return 2;
+    }
+    fprintf(stderr, "Serving %d automata on 127.0.0.1:%d\n", count, port);
+
+    pthread_mutex_init(&live.lock, NULL);
+    pthread_cond_init(&live.drained, NULL);
+    live.active = 0;
+    backoff.tv_sec = 0;
+    backoff.tv_nsec = SERVE_ACCEPT_BACKOFF_MS * 1000000L;
+    for (;;) {
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                nanosleep(&backoff, NULL); /* a connection closing frees what we need */
+                continue;
+            }
+            break;
+        }
+        connection = malloc(sizeof(ServeConnection));
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->server = &server;
+        connection->live = &live;
+        connection->fd = fd;
+        pthread_mutex_lock(&live.lock);
+        live.active++;
+        pthread_mutex_unlock(&live.lock);
+        if (pthread_create(&thread, NULL, serveConnectionMain, connection) != 0) {
+            pthread_mutex_lock(&live.lock);
+            live.active--;
+            pthread_mutex_unlock(&live.lock);
+            close(fd);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    printf("Error: Cannot accept connections\n");
+    close(listener);
+    pthread_mutex_lock(&live.lock);
+    while (live.active > 0) {
+        pthread_cond_wait(&live.drained, &live.lock);
+    }
+    pthread_mutex_unlock(&live.lock);
+    pthread_cond_destroy(&live.drained);
+    pthread_mutex_destroy(&live.lock);
+    freeServer(&server);
+    return 2;
+}
+
 /* Main Program */
-int main(void) {
+int main(int argc, char **argv) {
     FSM fsm;
+    FSMCursor cursor;
+    CompiledFSM compiled;
     ProcessResult result;
+    MatchResult match;
+    MatchInput batchInputs[4];
+    BatchResult batchResults[4];
     char input[MAX_INPUT_LEN];
     char pattern[MAX_INPUT_LEN];
-    int choice, i;
+    int choice, i, status;
     const char *testStrings[] = {"abc", "ab", "abcabc", "xyz"};
     int numTests = 4;
     
+    /* Command-line modes: match against the sample FSM and exit */
+    if (argc > 1) {
+        createSampleFSM(&fsm);
+        if (compileFSM(&fsm, &compiled) != 0) {
+            return 1;
+        }
+        if (strcmp(argv[1], "--stream") == 0) {
+            status = streamMode(&compiled);
+        } else if (argc > 2 && strcmp(argv[1], "--file") == 0) {
+            status = fileMode(&compiled, argv[2], 0, 1);
+        } else if (argc > 2 && strcmp(argv[1], "--file-parallel") == 0) {
+            status = fileMode(&compiled, argv[2], 0, argc > 3 ? atoi(argv[3]) : 0);
+        } else if (argc > 2 && strcmp(argv[1], "--lines") == 0) {
+            status = fileMode(&compiled, argv[2], 1, 1);
+        } else if (argc > 3 && strcmp(argv[1], "--search") == 0) {
+            status = searchMode(argv[2], argv[3]);
+        } else if (strcmp(argv[1], "--bench") == 0) {
+            status = benchMode(argc > 2 ? atol(argv[2]) : 1000000);
+        } else if (argc > 3 && strcmp(argv[1], "--compile") == 0) {
+            status = compileMode(argv[2], argv[3]);
+        } else if (argc > 3 && strcmp(argv[1], "--load") == 0) {
+            status = loadMode(argv[2], argv[3]);
+        } else if (argc > 3 && strcmp(argv[1], "--fsm") == 0) {
+            status = definitionMode(argv[2], argv[3]);
+        } else if (argc > 2 && strcmp(argv[1], "--serve") == 0) {
+            status = serveMode(argv + 2, argc - 2);
+        } else if (argc > 3 && strcmp(argv[1], "--serve-tcp") == 0) {
+            status = serveTcpMode(atoi(argv[2]), argv + 3, argc - 3);
+        } else if (argc > 4 && strcmp(argv[1], "--emit-c") == 0) {
+            status = emitMode(argv[2], argv[3], argv[4]);
+#ifdef AUTOMATA_PROFILE
+        } else if (argc > 3 && strcmp(argv[1], "--profile") == 0) {
+            status = profileMode(argv[2], argv[3]);
+        } else if (argc > 4 && strcmp(argv[1], "--reorder") == 0) {
+            status = reorderMode(argv[2], argv[3], argv[4]);
+#endif
+        } else {
+            printf("Usage: %s [--stream | --file PATH | --file-parallel PATH [THREADS] |"
+                   " --lines PATH | --search REGEX PATH |"
+                   " --bench [COUNT] | --compile REGEX OUT | --load AUTOMATON PATH |"
+                   " --fsm DEFINITION PATH | --emit-c DEFINITION NAME OUT |"
+                   " --serve AUTOMATON... | --serve-tcp PORT AUTOMATON...]\n", argv[0]);
+            status = 2;
+        }
+        freeCompiledFSM(&compiled);
+        freeFSM(&fsm);
+        return status;
+    }
+    
     printf("╔═══════════════════════════════════════════════════════════════╗\n");
     printf("║      Automata & Formal Language Simulator (C--)              ║\n");
     printf("╚═══════════════════════════════════════════════════════════════╝\n\n");
     
     /* Create sample FSM */
     createSampleFSM(&fsm);
+    resetFSM(&fsm, &cursor);
     printf("✓ Sample FSM created (accepts strings matching pattern: (abc)*)\n");
     
     /* Visualize FSM */
     visualizeFSM(&fsm);
     
+    /* Compile FSM */
+    if (compileFSM(&fsm, &compiled) != 0) {
+        return 1;
+    }
+    
     /* Automatic testing */
     printf("=== Automatic Testing ===\n");
     for (i = 0; i < numTests; i++) {
         printf("\nInput: \"%s\"\n", testStrings[i]);
         result = processString(&fsm, testStrings[i]);
         printTrace(&result);
+        freeProcessResult(&result);
+        match = matchCompiledFSM(&compiled, testStrings[i], strlen(testStrings[i]));
+        if (match.failOffset >= 0) {
+            printf("Compiled engine: REJECTED at offset %ld\n", match.failOffset);
+        } else {
+            printf("Compiled engine: %s\n", match.accepted ? "ACCEPTED" : "REJECTED");
+        }
+        batchInputs[i].data = testStrings[i];
+        batchInputs[i].length = strlen(testStrings[i]);
     }
     
+    /* Batch testing */
+    printf("\nBatch engine: %lu of %d accepted\n",
+           (unsigned long)matchBatch(&compiled, batchInputs, numTests, batchResults), numTests);
+    printf("Parallel batch engine: %lu of %d accepted\n",
+           (unsigned long)matchBatchParallel(&compiled, batchInputs, numTests, batchResults, 0),
+           numTests);
+    
     /* Interactive menu */
     while (1) {
         showMenu();
@@ -336,6 +6848,7 @@ int main(void) {
                 input[strcspn(input, "\n")] = 0; /* Remove newline */
                 result = processString(&fsm, input);
                 printTrace(&result);
+                freeProcessResult(&result);
                 break;
                 
             case 2:
@@ -349,10 +6862,16 @@ int main(void) {
                 printf("\n--- Analysis ---\n");
                 printf("Pattern: %s\n", pattern);
                 printf("Input: %s\n", input);
-                if (matchRegex(pattern, input)) {
-                    printf("✓ String MATCHES the pattern!\n");
-                } else {
-                    printf("✗ String does NOT match the pattern.\n");
+                switch (printRegexAutomata(pattern) != 0 ? -1 : matchRegex(pattern, input)) {
+                    case 1:
+                        printf("✓ String MATCHES the pattern!\n");
+                        break;
+                    case 0:
+                        printf("✗ String does NOT match the pattern.\n");
+                        break;
+                    default:
+                        printf("✗ Pattern could not be compiled.\n");
+                        break;
                 }
                 break;
                 
@@ -361,12 +6880,14 @@ int main(void) {
                 break;
                 
             case 4:
-                resetFSM(&fsm);
+                resetFSM(&fsm, &cursor);
                 printf("✓ FSM reset to initial state.\n");
                 break;
                 
             case 5:
                 printf("\nExiting simulator. Goodbye!\n");
+                freeCompiledFSM(&compiled);
+                freeFSM(&fsm);
                 return 0;
                 
             default:
@@ -375,4 +6896,6 @@ int main(void) {
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+#endif /* AUTOMATA_NO_MAIN */
@@ -0,0 +1,1071 @@
+/* Regression driver for the C-- automata simulator: each engine is checked
+   against a brute-force reference or against the engines it must agree with,
+   and malformed input must be rejected cleanly. Every section prints its name,
+   every failed check a FAIL line. Exits 1 if any check fails. */
+
+#define AUTOMATA_NO_MAIN
+#include "automata_simulator.c"
+
+#define TEST_PATTERNS 400         /* random patterns checked against the reference */
+#define TEST_MAX_DEPTH 4          /* nesting of generated pattern nodes */
+#define TEST_MAX_LENGTH 5         /* inputs are every string over TEST_SYMBOLS up to this */
+#define TEST_SYMBOLS "abc"        /* patterns use 'a', 'b' and '.'; 'c' only matches '.' */
+#define TEST_LAZY_MEMORY (1 << 14) /* small enough that the lazy DFA flushes */
+#define TEST_BATCH_INPUTS 3000    /* random inputs for the batch and stream checks */
+#define TEST_BATCH_MAX_LENGTH 40
+#ifndef AUTOMATA_TEST_CC
+#define AUTOMATA_TEST_CC "cc"     /* compiles the generated matchers */
+#endif
+#define TEST_CACHE_TOKENS 200     /* distinct inputs behind the cached batches */
+#define TEST_CHUNK_THREADS 4
+#define TEST_CHUNK_BYTES (TEST_CHUNK_THREADS * CHUNK_MIN_BYTES * 2)
+#define TEST_SERVE_REQUESTS 20000 /* pipelined requests per serveStream run */
+
+/* Test Node: one node of a generated pattern, evaluated by testEnds */
+typedef struct {
+    int type;                     /* RegexNodeType; RX_SET is a literal or '.' */
+    char symbol;                  /* RX_SET: 'a', 'b' or '.' */
+    int left;
+    int right;
+    int min;
+    int max;                      /* RX_REPEAT, -1 = unbounded */
+} TestNode;
+
+/* Test Pattern: generated node tree and its rendering as a regex */
+typedef struct {
+    TestNode nodes[1 << (TEST_MAX_DEPTH + 1)];
+    int nodeCount;
+    char text[512];
+} TestPattern;
+
+/* Test Pipe Writer: feeds one buffer into a pipe from its own thread */
+typedef struct {
+    int fd;
+    const char *data;
+    size_t length;
+} TestPipeWriter;
+
+/* Test Serve Run: serveStream on its own thread between two pipes */
+typedef struct {
+    const MatchServer *server;
+    int inFd;
+    int outFd;
+    int status;
+} TestServeRun;
+
+static int checkCount = 0;
+static int failCount = 0;
+
+/* Check: count one check, reporting it if it failed */
+static void check(int ok, const char *what, const char *detail) {
+    checkCount++;
+    if (!ok) {
+        failCount++;
+        printf("FAIL %s: %s\n", what, detail);
+    }
+}
+
+/* Test Random: next value of the driver's reproducible LCG */
+static unsigned int testRandom(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+/* Compile Regex DFA: pattern determinized, minimized and compiled */
+static int compileRegexDFA(const char *pattern, FSM *minimized, CompiledFSM *cfsm) {
+    FSM nfa, dfa;
+    MinimizeStats stats;
+    int status = -1;
+
+    if (compileRegex(pattern, &nfa) != 0) {
+        return -1;
+    }
+    if (determinizeNFA(&nfa, &dfa, 0) == 0) {
+        if (minimizeFSM(&dfa, minimized, &stats) == 0) {
+            status = compileFSM(minimized, cfsm);
+            if (status != 0) {
+                freeFSM(minimized);
+            }
+        }
+        freeFSM(&dfa);
+    }
+    freeFSM(&nfa);
+    return status;
+}
+
+/* Generate Node: random pattern node of at most depth levels */
+static int generateNode(TestPattern *pattern, int depth, unsigned int *seed) {
+    int index = pattern->nodeCount++;
+    TestNode *node = &pattern->nodes[index];
+    int pick;
+
+    pick = depth > 0 ? (int)(testRandom(seed) % 9) : 0;
+    node->left = node->right = -1;
+    switch (pick) {
+        case 0:
+        case 1:
+            node->type = RX_SET;
+            node->symbol = "aab."[testRandom(seed) % 4];
+            return index;
+        case 2:
+        case 3:
+            node->type = RX_CONCAT;
+            break;
+        case 4:
+            node->type = RX_ALT;
+            break;
+        case 5:
+            node->type = RX_STAR;
+            break;
+        case 6:
+            node->type = RX_PLUS;
+            break;
+        case 7:
+            node->type = RX_QUEST;
+            break;
+        default:
+            node->type = RX_REPEAT;
+            node->min = (int)(testRandom(seed) % 3);
+            node->max = testRandom(seed) % 3 == 0 ? -1 : node->min + (int)(testRandom(seed) % 2);
+            break;
+    }
+    node->left = generateNode(pattern, depth - 1, seed);
+    if (pick == 2 || pick == 3 || pick == 4) {
+        node->right = generateNode(pattern, depth - 1, seed);
+    }
+    return index;
+}
+
+/* Render Node: append node as regex text; quantified quantifiers are left bare
+   ("a*+") so stacked quantifiers are exercised too */
+static void renderNode(TestPattern *pattern, int index, char *out) {
+    const TestNode *node = &pattern->nodes[index];
+    const TestNode *child = node->left >= 0 ? &pattern->nodes[node->left] : NULL;
+    char bound[32];
+    int bare;
+
+    switch (node->type) {
+        case RX_SET:
+            sprintf(out + strlen(out), "%c", node->symbol);
+            return;
+        case RX_CONCAT:
+        case RX_ALT:
+            strcat(out, "(");
+            renderNode(pattern, node->left, out);
+            strcat(out, node->type == RX_ALT ? "|" : ")(");
+            renderNode(pattern, node->right, out);
+            strcat(out, ")");
+            return;
+        default:
+            bare = child->type != RX_CONCAT && child->type != RX_ALT;
+            strcat(out, bare ? "" : "(");
+            renderNode(pattern, node->left, out);
+            strcat(out, bare ? "" : ")");
+            if (node->type == RX_REPEAT) {
+                if (node->max < 0) {
+                    sprintf(bound, "{%d,}", node->min);
+                } else {
+                    sprintf(bound, "{%d,%d}", node->min, node->max);
+                }
+                strcat(out, bound);
+            } else {
+                strcat(out, node->type == RX_STAR ? "*" : node->type == RX_PLUS ? "+" : "?");
+            }
+            return;
+    }
+}
+
+/* Test Ends: brute-force reference, the set (bit mask) of end offsets of node
+   matched from every start offset in starts */
+static unsigned int testEnds(const TestPattern *pattern, int index, const char *input,
+                             size_t length, unsigned int starts) {
+    const TestNode *node = &pattern->nodes[index];
+    unsigned int ends = 0, reached;
+    size_t p;
+    int i;
+
+    switch (node->type) {
+        case RX_SET:
+            for (p = 0; p < length; p++) {
+                if ((starts >> p & 1) && (node->symbol == '.' || input[p] == node->symbol)) {
+                    ends |= 1u << (p + 1);
+                }
+            }
+            return ends;
+        case RX_CONCAT:
+            return testEnds(pattern, node->right, input, length,
+                            testEnds(pattern, node->left, input, length, starts));
+        case RX_ALT:
+            return testEnds(pattern, node->left, input, length, starts) |
+                   testEnds(pattern, node->right, input, length, starts);
+        case RX_QUEST:
+            return starts | testEnds(pattern, node->left, input, length, starts);
+        case RX_STAR:
+        case RX_PLUS:
+            reached = node->type == RX_STAR ? starts :
+                      testEnds(pattern, node->left, input, length, starts);
+            do {
+                ends = reached;
+                reached |= testEnds(pattern, node->left, input, length, reached);
+            } while (reached != ends);
+            return ends;
+        default:
+            for (i = 0, reached = starts; i < node->min; i++) {
+                reached = testEnds(pattern, node->left, input, length, reached);
+            }
+            ends = reached;
+            for (i = node->min; node->max < 0 || i < node->max; i++) {
+                reached = testEnds(pattern, node->left, input, length, reached);
+                if ((reached & ~ends) == 0) {
+                    break;
+                }
+                ends |= reached;
+            }
+            return ends;
+    }
+}
+
+/* Check Pattern: every engine against the reference on every short input */
+static void checkPattern(const TestPattern *pattern, const char *path) {
+    static char inputs[1024][TEST_MAX_LENGTH + 1];
+    MatchInput batch[1024];
+    BatchResult results[1024];
+    FSM nfa, dfa, minimized;
+    NFAProgram program;
+    LazyDFA lazy;
+    CompiledFSM cfsm, cmin;
+    PackedFSM packed;
+    LoadedAutomaton loaded;
+    Searcher searcher;
+    MinimizeStats stats;
+    MatchSpan span;
+    char detail[640];
+    size_t count = 0, length, i, s, longest;
+    unsigned int ends, found;
+    int expected, got[16], engines, n, k, d, built;
+
+    /* Every string over TEST_SYMBOLS of length 0..TEST_MAX_LENGTH */
+    for (length = 0; length <= TEST_MAX_LENGTH; length++) {
+        for (n = 1, i = 0; i < length; i++) {
+            n *= (int)strlen(TEST_SYMBOLS);
+        }
+        for (k = 0; k < n; k++) {
+            for (i = 0, d = k; i < length; i++, d /= (int)strlen(TEST_SYMBOLS)) {
+                inputs[count][i] = TEST_SYMBOLS[d % (int)strlen(TEST_SYMBOLS)];
+            }
+            inputs[count][length] = '\0';
+            batch[count].data = inputs[count];
+            batch[count].length = length;
+            count++;
+        }
+    }
+
+    if (compileRegex(pattern->text, &nfa) != 0) {
+        check(0, "compileRegex", pattern->text);
+        return;
+    }
+    built = buildNFAProgram(&nfa, &program) == 0;
+    built = built && initLazyDFA(&lazy, &program, TEST_LAZY_MEMORY) == 0;
+    built = built && determinizeNFA(&nfa, &dfa, 0) == 0;
+    built = built && compileFSM(&dfa, &cfsm) == 0;
+    built = built && minimizeFSM(&dfa, &minimized, &stats) == 0;
+    built = built && compileFSM(&minimized, &cmin) == 0;
+    built = built && packCompiledFSM(&cmin, &packed) == 0;
+    built = built && saveCompiledFSM(&cmin, path) == 0;
+    built = built && loadCompiledFSM(path, &loaded) == 0;
+    built = built && compileSearcher(&nfa, &searcher, 0) == 0;
+    check(built, "build engines", pattern->text);
+    if (!built) {
+        exit(1); /* partially built engines cannot be released safely */
+    }
+    matchBatchInterleaved(&loaded.cfsm, batch, count, results);
+
+    for (i = 0; i < count; i++) {
+        length = batch[i].length;
+        ends = testEnds(pattern, 0, inputs[i], length, 1u);
+        expected = (int)(ends >> length & 1);
+        engines = 0;
+        got[engines++] = matchRegex(pattern->text, inputs[i]);
+        got[engines++] = runNFAProgram(&program, inputs[i], length);
+        got[engines++] = runLazyDFA(&lazy, inputs[i], length);
+        got[engines++] = runCompiledFSM(&cfsm, inputs[i], length);
+        got[engines++] = runCompiledFSM(&cmin, inputs[i], length);
+        got[engines++] = runCompiledFSM(&loaded.cfsm, inputs[i], length);
+        got[engines++] = results[i].accepted;
+        got[engines++] = runPackedFSM(&packed, inputs[i], length);
+        for (k = 0; k < engines; k++) {
+            if (got[k] != expected) {
+                sprintf(detail, "%s on \"%.*s\": engine %d says %d, reference %d",
+                        pattern->text, (int)length, inputs[i], k, got[k], expected);
+                check(0, "full match", detail);
+                break;
+            }
+        }
+        if (k == engines) {
+            check(1, "full match", "");
+        }
+
+        /* Leftmost-longest search: the first start with any end, then its last end */
+        for (s = 0, found = 0; s <= length && !found; s++) {
+            found = testEnds(pattern, 0, inputs[i], length, 1u << s);
+        }
+        for (longest = length; found && !(found >> longest & 1); longest--) {
+        }
+        k = searchFirst(&searcher, inputs[i], length, SEARCH_LEFTMOST_LONGEST, &span);
+        sprintf(detail, "%s in \"%.*s\"", pattern->text, (int)length, inputs[i]);
+        check(k == (found != 0) &&
+              (!found || (span.start == s - 1 && span.end == longest)), "search", detail);
+    }
+
+    freeSearcher(&searcher);
+    unloadCompiledFSM(&loaded);
+    freePackedFSM(&packed);
+    freeCompiledFSM(&cmin);
+    freeFSM(&minimized);
+    freeCompiledFSM(&cfsm);
+    freeFSM(&dfa);
+    freeLazyDFA(&lazy);
+    freeNFAProgram(&program);
+    freeFSM(&nfa);
+}
+
+/* Test Regex Engines: random patterns, every engine against the reference */
+static void testRegexEngines(void) {
+    TestPattern pattern;
+    char path[] = "/tmp/automata_testXXXXXX";
+    unsigned int seed = 2024;
+    int p, fd;
+
+    printf("=== Regex engines vs reference ===\n");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        check(0, "mkstemp", path);
+        return;
+    }
+    close(fd);
+    for (p = 0; p < TEST_PATTERNS; p++) {
+        pattern.nodeCount = 0;
+        generateNode(&pattern, TEST_MAX_DEPTH, &seed);
+        pattern.text[0] = '\0';
+        renderNode(&pattern, 0, pattern.text);
+        checkPattern(&pattern, path);
+    }
+    unlink(path);
+}
+
+/* Make Batch Inputs: count random strings over symbols, NUL-terminated in one buffer */
+static char *makeBatchInputs(MatchInput *inputs, size_t count, const char *symbols,
+                             unsigned int *seed) {
+    char *buffer = malloc(count * (TEST_BATCH_MAX_LENGTH + 1));
+    size_t i, j, length;
+
+    if (buffer == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        inputs[i].data = buffer + i * (TEST_BATCH_MAX_LENGTH + 1);
+        length = testRandom(seed) % (TEST_BATCH_MAX_LENGTH + 1);
+        for (j = 0; j < length; j++) {
+            buffer[i * (TEST_BATCH_MAX_LENGTH + 1) + j] =
+                symbols[testRandom(seed) % strlen(symbols)];
+        }
+        buffer[i * (TEST_BATCH_MAX_LENGTH + 1) + length] = '\0';
+        inputs[i].length = length;
+    }
+    return buffer;
+}
+
+/* Same Result: does a batch result carry the verdict and failure offset of match? */
+static int sameResult(const BatchResult *result, const MatchResult *match) {
+    return result->accepted == (unsigned int)match->accepted &&
+           (match->failOffset < 0 ? result->failOffset == BATCH_NO_FAILURE :
+            (long)result->failOffset == match->failOffset);
+}
+
+/* Check Batch Engines: every batch kernel and the traced and streamed runs
+   against matchCompiledFSM on inputs */
+static void checkBatchEngines(const FSM *fsm, const CompiledFSM *cfsm, const char *name,
+                              const MatchInput *inputs, size_t count) {
+    static const int threadCounts[] = {1, 3, 0};
+    BatchResult *results = malloc(count * sizeof(BatchResult));
+    ProcessResult traced;
+    StreamMatcher stream;
+    MatchResult match, streamed;
+    char detail[128];
+    size_t i, at, step;
+    int t, ok;
+
+    if (results == NULL) {
+        check(0, "batch", "out of memory");
+        return;
+    }
+    for (i = 0, ok = 1; i < count && ok; i++) {
+        match = matchCompiledFSM(cfsm, inputs[i].data, inputs[i].length);
+        traced = processString(fsm, inputs[i].data);
+        ok = traced.accepted == match.accepted;
+        freeProcessResult(&traced);
+
+        /* Streamed in chunks of 1, 2, 3 ... bytes */
+        streamInit(&stream, cfsm);
+        for (at = 0, step = 1; at < inputs[i].length; at += step, step++) {
+            streamFeed(&stream, inputs[i].data + at,
+                       step < inputs[i].length - at ? step : inputs[i].length - at);
+        }
+        streamed = streamFinish(&stream);
+        ok = ok && streamed.accepted == match.accepted &&
+             streamed.failOffset == match.failOffset;
+    }
+    sprintf(detail, "%s: input %lu", name, (unsigned long)(i - 1));
+    check(ok, "processString and streaming", detail);
+
+    for (t = -2; t < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); t++) {
+        memset(results, 0xFF, count * sizeof(BatchResult));
+        if (t == -2) {
+            matchBatch(cfsm, inputs, count, results);
+        } else if (t == -1) {
+            matchBatchInterleaved(cfsm, inputs, count, results);
+        } else {
+            matchBatchParallel(cfsm, inputs, count, results, threadCounts[t]);
+        }
+        for (i = 0, ok = 1; i < count && ok; i++) {
+            match = matchCompiledFSM(cfsm, inputs[i].data, inputs[i].length);
+            ok = sameResult(&results[i], &match);
+        }
+        sprintf(detail, "%s: %s, input %lu", name,
+                t == -2 ? "matchBatch" : t == -1 ? "interleaved" : "parallel",
+                (unsigned long)(i - 1));
+        check(ok, "batch result", detail);
+    }
+    free(results);
+}
+
+/* Test Batch Engines: the sample machine and a regex DFA over random inputs */
+static void testBatchEngines(void) {
+    MatchInput *inputs = malloc(TEST_BATCH_INPUTS * sizeof(MatchInput));
+    FSM fsm;
+    CompiledFSM cfsm;
+    unsigned int seed = 99;
+    char *buffer;
+
+    printf("=== Batch and streaming engines ===\n");
+    if (inputs == NULL) {
+        check(0, "batch", "out of memory");
+        return;
+    }
+    createSampleFSM(&fsm);
+    buffer = makeBatchInputs(inputs, TEST_BATCH_INPUTS, "abcx", &seed);
+    if (buffer != NULL && compileFSM(&fsm, &cfsm) == 0) {
+        checkBatchEngines(&fsm, &cfsm, "createSampleFSM", inputs, TEST_BATCH_INPUTS);
+        freeCompiledFSM(&cfsm);
+    } else {
+        check(0, "batch", "createSampleFSM");
+    }
+    freeFSM(&fsm);
+    free(buffer);
+
+    buffer = makeBatchInputs(inputs, TEST_BATCH_INPUTS, "ab01", &seed);
+    if (buffer != NULL && compileRegexDFA("(a|b)*abb(0|1)*", &fsm, &cfsm) == 0) {
+        checkBatchEngines(&fsm, &cfsm, "(a|b)*abb(0|1)*", inputs, TEST_BATCH_INPUTS);
+        freeCompiledFSM(&cfsm);
+        freeFSM(&fsm);
+    } else {
+        check(0, "batch", "(a|b)*abb(0|1)*");
+    }
+    free(buffer);
+    free(inputs);
+}
+
+/* Test Early Settle: absorbing states accept without reading on, dead ones
+   reject at the first byte that rules a match out, and every engine agrees */
+static void testEarlySettle(void) {
+    static const char tail[] = "zz\n\x01\xff";
+    FSM fsm;
+    CompiledFSM cfsm;
+    PackedFSM packed;
+    MatchInput input;
+    BatchResult result;
+    MatchResult match;
+    StreamMatcher stream;
+    int fed[3];
+
+    printf("=== Early accept and reject ===\n");
+    if (compileRegexDFA("ab[\\x00-\\xff]*", &fsm, &cfsm) != 0) {
+        check(0, "early settle", "ab[\\x00-\\xff]* does not compile");
+        return;
+    }
+    check(cfsm.absorbStart < cfsm.stateCount * cfsm.classCount, "absorbing state",
+          "ab[\\x00-\\xff]* has none");
+    match = matchCompiledFSM(&cfsm, "abzz", 4);
+    check(match.accepted && match.failOffset == -1, "absorbed", "abzz");
+    match = matchCompiledFSM(&cfsm, "b", 1);
+    check(!match.accepted && match.failOffset == 0, "dead state", "b rejected at 0");
+    match = matchCompiledFSM(&cfsm, "a", 1);
+    check(!match.accepted && match.failOffset == -1, "live state", "a read to its end");
+
+    input.data = "ab\n";
+    input.length = 3;
+    matchBatchInterleaved(&cfsm, &input, 1, &result);
+    check(result.accepted && result.failOffset == BATCH_NO_FAILURE, "absorbed", "interleaved");
+    if (packCompiledFSM(&cfsm, &packed) == 0) {
+        check(runPackedFSM(&packed, "ab\xff", 3) == 1 && runPackedFSM(&packed, "ba", 2) == 0,
+              "absorbed", "packed");
+        freePackedFSM(&packed);
+    } else {
+        check(0, "packCompiledFSM", "ab[\\x00-\\xff]*");
+    }
+
+    /* A settled stream says so, and chunks fed after that are not read */
+    streamInit(&stream, &cfsm);
+    fed[0] = streamFeed(&stream, "a", 1);
+    fed[1] = streamFeed(&stream, "bz", 2);
+    fed[2] = streamFeed(&stream, tail, sizeof(tail) - 1);
+    check(fed[0] == 0 && fed[1] == STREAM_SETTLED && fed[2] == STREAM_SETTLED &&
+          streamFinish(&stream).accepted && stream.offset == 3 + (long)sizeof(tail) - 1,
+          "stream settled", "ab[\\x00-\\xff]* fed a, bz, tail");
+    streamInit(&stream, &cfsm);
+    check(streamFeed(&stream, "ax", 2) == -1 && streamFinish(&stream).failOffset == 1,
+          "stream rejected", "ax");
+    freeCompiledFSM(&cfsm);
+    freeFSM(&fsm);
+}
+
+/* Check Emitted Source: compile emitFSMSource's matcher with a driver that
+   prints its verdict per input line, and compare with runCompiledFSM */
+static void checkEmittedSource(const char *pattern, const char *symbols) {
+    char dir[] = "/tmp/automata_emitXXXXXX";
+    char path[256], command[1024], line[64], detail[128];
+    FSM fsm;
+    CompiledFSM cfsm;
+    FILE *out, *verdicts;
+    int n, k, d, i, length, ok = 1;
+
+    if (compileRegexDFA(pattern, &fsm, &cfsm) != 0 || mkdtemp(dir) == NULL) {
+        check(0, "emit", pattern);
+        return;
+    }
+
+    sprintf(path, "%s/matcher.c", dir);
+    out = fopen(path, "w");
+    ok = out != NULL && emitFSMSource(&fsm, "test_match", out) == 0;
+    if (out != NULL) {
+        fprintf(out, "\n#include <stdio.h>\n#include <string.h>\n\n"
+                     "int main(void) {\n"
+                     "    char line[64];\n\n"
+                     "    while (fgets(line, sizeof(line), stdin) != NULL) {\n"
+                     "        line[strcspn(line, \"\\n\")] = '\\0';\n"
+                     "        printf(\"%%d\\n\", test_match(line, strlen(line)));\n"
+                     "    }\n"
+                     "    return 0;\n"
+                     "}\n");
+        ok = fclose(out) == 0 && ok;
+    }
+    check(ok, "emitFSMSource", pattern);
+
+    /* Every string over symbols up to length 4 */
+    sprintf(path, "%s/inputs.txt", dir);
+    out = fopen(path, "w");
+    for (length = 0; out != NULL && length <= 4; length++) {
+        for (n = 1, i = 0; i < length; i++) {
+            n *= (int)strlen(symbols);
+        }
+        for (k = 0; k < n; k++) {
+            for (i = 0, d = k; i < length; i++, d /= (int)strlen(symbols)) {
+                fputc(symbols[d % (int)strlen(symbols)], out);
+            }
+            fputc('\n', out);
+        }
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+
+    sprintf(command, "%s -O1 -o %s/matcher %s/matcher.c && %s/matcher < %s/inputs.txt > %s/out.txt",
+            AUTOMATA_TEST_CC, dir, dir, dir, dir, dir);
+    if (ok && system(command) != 0) {
+        printf("SKIP emitted source: '%s' failed\n", command);
+        ok = 0;
+    } else if (ok) {
+        sprintf(path, "%s/inputs.txt", dir);
+        out = fopen(path, "r");
+        sprintf(path, "%s/out.txt", dir);
+        verdicts = fopen(path, "r");
+
+        while (out != NULL && verdicts != NULL && fgets(line, sizeof(line), out) != NULL) {
+            line[strcspn(line, "\n")] = '\0';
+            if (fscanf(verdicts, "%d", &k) != 1 ||
+                k != runCompiledFSM(&cfsm, line, strlen(line))) {
+                sprintf(detail, "%s on \"%s\"", pattern, line);
+                check(0, "emitted matcher", detail);
+                break;
+            }
+            check(1, "emitted matcher", "");
+        }
+        if (out != NULL) {
+            fclose(out);
+        }
+        if (verdicts != NULL) {
+            fclose(verdicts);
+        }
+    }
+
+    sprintf(command, "rm -rf %s", dir);
+    if (system(command) != 0) {
+        printf("Warning: could not remove %s\n", dir);
+    }
+    freeCompiledFSM(&cfsm);
+    freeFSM(&fsm);
+}
+
+/* Test Emitted Source: generated matchers for dense, sparse and absorbing DFAs */
+static void testEmittedSource(void) {
+    printf("=== Generated matchers ===\n");
+    checkEmittedSource("(a|b)*abb", "abc");
+    checkEmittedSource("[0-9]+(\\.[0-9]+)?", "1.a");
+    checkEmittedSource("ab[\\x00-\\xff]*", "ab\x01");
+}
+
+/* Test Result Cache: cached batches, hit or miss, answer as matchBatch does */
+static void testResultCache(void) {
+    MatchInput *inputs = malloc(TEST_BATCH_INPUTS * sizeof(MatchInput));
+    MatchInput tokens[TEST_CACHE_TOKENS];
+    BatchResult *expected = malloc(TEST_BATCH_INPUTS * sizeof(BatchResult));
+    BatchResult *results = malloc(TEST_BATCH_INPUTS * sizeof(BatchResult));
+    ResultCache cache;
+    ResultCacheStats stats;
+    FSM fsm;
+    CompiledFSM cfsm;
+    unsigned int seed = 7;
+    char *buffer = NULL, detail[64];
+    size_t i;
+    int round, ok;
+
+    printf("=== Result cache ===\n");
+    if (inputs == NULL || expected == NULL || results == NULL ||
+        (buffer = makeBatchInputs(tokens, TEST_CACHE_TOKENS, "ab01", &seed)) == NULL ||
+        compileRegexDFA("(a|b)*abb(0|1)*", &fsm, &cfsm) != 0) {
+        check(0, "result cache", "setup failed");
+        free(inputs);
+        free(expected);
+        free(results);
+        free(buffer);
+        return;
+    }
+    /* Repeats of a few tokens; a long one bypasses the cache */
+    for (i = 0; i < TEST_BATCH_INPUTS; i++) {
+        inputs[i] = tokens[testRandom(&seed) % TEST_CACHE_TOKENS];
+    }
+    inputs[0].data = "abababababababababababababababababababababababababababbb01";
+    inputs[0].length = strlen(inputs[0].data);
+    matchBatch(&cfsm, inputs, TEST_BATCH_INPUTS, expected);
+
+    /* Two shards of 64 entries: most tokens get evicted and come back */
+    if (initResultCache(&cache, 2, 64) != 0) {
+        check(0, "initResultCache", "2 x 64");
+    } else {
+        for (round = 0; round < 2; round++) {
+            memset(results, 0, TEST_BATCH_INPUTS * sizeof(BatchResult));
+            if (round == 0) {
+                matchBatchCached(&cfsm, 1, &cache.shards[0], inputs, TEST_BATCH_INPUTS, results);
+            } else {
+                matchBatchParallelCached(&cfsm, 1, &cache, inputs, TEST_BATCH_INPUTS, results);
+            }
+            for (i = 0, ok = 1; i < TEST_BATCH_INPUTS && ok; i++) {
+                ok = results[i].accepted == expected[i].accepted &&
+                     results[i].failOffset == expected[i].failOffset;
+            }
+            sprintf(detail, "%s, input %lu", round == 0 ? "one shard" : "parallel",
+                    (unsigned long)(i - 1));
+            check(ok, "cached result", detail);
+        }
+        resultCacheStats(&cache, &stats);
+        check(stats.hits > 0 && stats.misses > 0 && stats.bypasses >= 2 &&
+              stats.hits + stats.misses + stats.bypasses == 2 * TEST_BATCH_INPUTS,
+              "cache counters", "hits, misses and bypasses cover every lookup");
+        freeResultCache(&cache);
+    }
+
+    freeCompiledFSM(&cfsm);
+    freeFSM(&fsm);
+    free(buffer);
+    free(results);
+    free(expected);
+    free(inputs);
+}
+
+/* Build Counter DFA: counts 'a' modulo modulus, 'r' resets, accepts at zero */
+static void buildCounterDFA(FSM *fsm, int modulus) {
+    char name[16];
+    int i;
+
+    initializeFSM(fsm);
+    for (i = 0; i < modulus; i++) {
+        sprintf(name, "c%d", i);
+        addState(fsm, name, i == 0);
+    }
+    for (i = 0; i < modulus; i++) {
+        addTransition(fsm, i, (i + 1) % modulus, 'a');
+        addTransition(fsm, i, 0, 'r');
+    }
+}
+
+/* Check Chunked: matchCompiledParallel against matchCompiledFSM on input; with
+   mustMap, also that every speculative chunk mapped the real start state */
+static void checkChunked(const CompiledFSM *cfsm, const char *name, const char *input,
+                         size_t length, int mustMap) {
+    ChunkRun chunk;
+    MatchResult parallel = matchCompiledParallel(cfsm, input, length, TEST_CHUNK_THREADS);
+    MatchResult sequential = matchCompiledFSM(cfsm, input, length);
+    size_t size = length / TEST_CHUNK_THREADS;
+    int i, state = cfsm->initialState, mapped = 1;
+    char detail[128];
+
+    sprintf(detail, "%s: accepted %d/%d final %d/%d fail %ld/%ld", name, parallel.accepted,
+            sequential.accepted, parallel.finalState, sequential.finalState,
+            parallel.failOffset, sequential.failOffset);
+    check(parallel.accepted == sequential.accepted &&
+          parallel.finalState == sequential.finalState &&
+          parallel.failOffset == sequential.failOffset, "parallel verdict", detail);
+    if (!mustMap) {
+        return;
+    }
+
+    /* Chunks as matchCompiledParallel cuts them; none may need the fallback */
+    for (i = 1; i < TEST_CHUNK_THREADS; i++) {
+        runTable(cfsm, &state, (const unsigned char *)input + size * (i - 1), size);
+        memset(&chunk, 0, sizeof(chunk));
+        chunk.cfsm = cfsm;
+        chunk.data = (const unsigned char *)input;
+        chunk.begin = size * i;
+        chunk.end = i == TEST_CHUNK_THREADS - 1 ? length : size * (i + 1);
+        chunk.lookback = chunk.begin > CHUNK_LOOKBACK ? chunk.begin - CHUNK_LOOKBACK : 0;
+        runChunkMain(&chunk);
+        mapped &= !chunk.gaveUp && chunk.laneOf[state / cfsm->classCount] >= 0;
+        freeChunkRun(&chunk);
+    }
+    sprintf(detail, "%s: a chunk fell back to a sequential walk", name);
+    check(mapped, "parallel without fallback", detail);
+}
+
+/* Test Parallel Chunks: converging and sample DFAs, accepted and rejected inputs */
+static void testParallelChunks(void) {
+    FSM fsm;
+    CompiledFSM cfsm;
+    char *input = malloc(TEST_CHUNK_BYTES);
+    char name[32];
+    size_t i;
+    int modulus;
+
+    printf("=== Parallel chunks vs sequential ===\n");
+    if (input == NULL) {
+        check(0, "parallel", "out of memory");
+        return;
+    }
+    for (modulus = 5; modulus <= 7; modulus += 2) {
+        buildCounterDFA(&fsm, modulus);
+        if (compileFSM(&fsm, &cfsm) != 0) {
+            check(0, "compileFSM", "counter DFA");
+            freeFSM(&fsm);
+            continue;
+        }
+        for (i = 0; i < TEST_CHUNK_BYTES; i++) {
+            input[i] = i % 50 == 49 ? 'r' : 'a';
+        }
+        sprintf(name, "mod %d counter", modulus);
+        checkChunked(&cfsm, name, input, TEST_CHUNK_BYTES, 1);
+        checkChunked(&cfsm, name, input, TEST_CHUNK_BYTES - 7, 1);
+        input[TEST_CHUNK_BYTES / 3 * 2] = 'x'; /* rejected inside a later chunk */
+        checkChunked(&cfsm, name, input, TEST_CHUNK_BYTES, 0);
+        freeCompiledFSM(&cfsm);
+        freeFSM(&fsm);
+    }
+
+    createSampleFSM(&fsm);
+    if (compileFSM(&fsm, &cfsm) == 0) {
+        for (i = 0; i < TEST_CHUNK_BYTES; i++) {
+            input[i] = "abc"[i % 3];
+        }
+        checkChunked(&cfsm, "createSampleFSM", input, TEST_CHUNK_BYTES - 1, 1);
+        checkChunked(&cfsm, "createSampleFSM", input, TEST_CHUNK_BYTES - 2, 0);
+        freeCompiledFSM(&cfsm);
+    } else {
+        check(0, "compileFSM", "createSampleFSM");
+    }
+    freeFSM(&fsm);
+    free(input);
+}
+
+/* Test Minimize Empty: languages with no reachable accepting state */
+static void testMinimizeEmpty(void) {
+    FSM fsm, minimized;
+    MinimizeStats stats;
+    CompiledFSM cfsm;
+
+    printf("=== Minimize empty languages ===\n");
+    initializeFSM(&fsm);
+    check(minimizeFSM(&fsm, &minimized, &stats) == 0 && minimized.stateCount == 1 &&
+          strcmp(minimized.stateNames[0], "dead") == 0 && !minimized.states[0].isAccepting,
+          "minimize", "FSM with no states");
+    freeFSM(&minimized);
+    freeFSM(&fsm);
+
+    initializeFSM(&fsm);
+    addState(&fsm, "q0", 0);
+    addState(&fsm, "q1", 1); /* accepting but unreachable */
+    addTransition(&fsm, 0, 0, 'a');
+    check(minimizeFSM(&fsm, &minimized, &stats) == 0 && minimized.stateCount == 1 &&
+          strcmp(minimized.stateNames[0], "q0") == 0 && compileFSM(&minimized, &cfsm) == 0 &&
+          !runCompiledFSM(&cfsm, "", 0), "minimize", "unreachable accepting state");
+    freeCompiledFSM(&cfsm);
+    freeFSM(&minimized);
+    freeFSM(&fsm);
+}
+
+/* Test Rejections: malformed definitions and patterns fail cleanly */
+static void testRejections(void) {
+    static const char *const badDefinitions[] = {
+        "q0 \\x:0 q1", "q0 \\x?f q1",
+        "q0 U+12G q1", "q0 U+110000 q1",
+        "q0 \\xg0 q1", "q0 \\x4 q1", "q0 a"
+    };
+    static const char *const goodEscapes[] = {"q0 \\xA0 q1", "q0 \\xfF q1", "q0 \\x09 q1"};
+    static const unsigned char goodSymbols[] = {0xA0, 0xFF, 0x09};
+    static const char cyrillic[] = "start q0\naccept q1\nq0 U+0400-U+04FF q1\n";
+    CompiledFSM cfsm;
+    size_t i, length = 2000000;
+    char *pattern = malloc(length + 2);
+    FSM fsm;
+
+    printf("=== Rejection of malformed input ===\n");
+    for (i = 0; i < sizeof(badDefinitions) / sizeof(badDefinitions[0]); i++) {
+        check(loadFSMText(badDefinitions[i], strlen(badDefinitions[i]), &fsm) != 0,
+              "definition accepted", badDefinitions[i]);
+    }
+    for (i = 0; i < sizeof(goodEscapes) / sizeof(goodEscapes[0]); i++) {
+        if (loadFSMText(goodEscapes[i], strlen(goodEscapes[i]), &fsm) != 0) {
+            check(0, "definition rejected", goodEscapes[i]);
+            continue;
+        }
+        check(fsm.transitionCount == 1 &&
+              (unsigned char)fsm.transitions[0].symbol == goodSymbols[i],
+              "escape decoded", goodEscapes[i]);
+        freeFSM(&fsm);
+    }
+    if (loadFSMText(cyrillic, strlen(cyrillic), &fsm) == 0 && compileFSM(&fsm, &cfsm) == 0) {
+        check(runCompiledFSM(&cfsm, "\xd0\x96", 2) == 1 && runCompiledFSM(&cfsm, "\xd3\xbf", 2) == 1 &&
+              runCompiledFSM(&cfsm, "\xd5\x80", 2) == 0 && runCompiledFSM(&cfsm, "\xd0", 1) == 0,
+              "code point range", "U+0400-U+04FF as UTF-8");
+        freeCompiledFSM(&cfsm);
+        freeFSM(&fsm);
+    } else {
+        check(0, "definition rejected", "U+0400-U+04FF");
+    }
+
+    if (pattern == NULL) {
+        check(0, "regex limits", "out of memory");
+        return;
+    }
+    memset(pattern, '*', length + 1);
+    pattern[0] = 'a';
+    pattern[length + 1] = '\0';
+    check(matchRegex(pattern, "aaaa") == 1 && matchRegex(pattern, "") == 1 &&
+          matchRegex(pattern, "b") == 0, "stacked quantifiers", "a followed by 2M '*'");
+    strcpy(pattern, "a");
+    for (i = 0; i <= REGEX_MAX_DEPTH; i++) {
+        strcat(pattern, "{1}");
+    }
+    check(matchRegex(pattern, "a") == -1, "nested repetition accepted", "a{1}{1}...");
+    for (i = 0; i <= REGEX_MAX_DEPTH; i++) {
+        pattern[i] = '(';
+        pattern[2 * REGEX_MAX_DEPTH + 3 - i] = ')';
+    }
+    pattern[REGEX_MAX_DEPTH + 1] = 'a';
+    pattern[REGEX_MAX_DEPTH + 2] = 'a';
+    pattern[2 * REGEX_MAX_DEPTH + 4] = '\0';
+    check(matchRegex(pattern, "aa") == -1, "nested groups accepted", "((((...))))");
+    check(matchRegex("a)", "a") == -1 && matchRegex("(a", "a") == -1 &&
+          matchRegex("*a", "a") == -1 && matchRegex("a{3,1}", "aa") == -1 &&
+          matchRegex("[z-a]", "a") == -1, "malformed regex accepted", "a) (a *a a{3,1} [z-a]");
+    free(pattern);
+}
+
+/* Test Pipe Writer Main: write the whole buffer, then close the pipe (thread body) */
+static void *testPipeWriterMain(void *arg) {
+    TestPipeWriter *writer = arg;
+
+    writeAll(writer->fd, writer->data, writer->length);
+    close(writer->fd);
+    return NULL;
+}
+
+/* Test Serve Main: serveStream between the run's pipes (thread body) */
+static void *testServeMain(void *arg) {
+    TestServeRun *run = arg;
+
+    run->status = serveStream(run->server, run->inFd, run->outFd);
+    close(run->outFd);
+    return NULL;
+}
+
+/* Run Serve: pipe requests through serveStream, returning the malloc'd responses */
+static char *runServe(const MatchServer *server, const char *requests, size_t length,
+                      size_t *responseLength, int *status) {
+    TestPipeWriter writer;
+    TestServeRun run;
+    pthread_t writerThread, serveThread;
+    int in[2], out[2];
+    size_t used = 0, capacity = 1 << 16;
+    char *responses = malloc(capacity), *grown;
+    ssize_t got;
+
+    *status = -1;
+    *responseLength = 0;
+    if (responses == NULL || pipe(in) != 0) {
+        free(responses);
+        return NULL;
+    }
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        free(responses);
+        return NULL;
+    }
+    writer.fd = in[1];
+    writer.data = requests;
+    writer.length = length;
+    run.server = server;
+    run.inFd = in[0];
+    run.outFd = out[1];
+    pthread_create(&writerThread, NULL, testPipeWriterMain, &writer);
+    pthread_create(&serveThread, NULL, testServeMain, &run);
+    while ((got = read(out[0], responses + used, capacity - used)) > 0) {
+        used += (size_t)got;
+        if (used == capacity) {
+            grown = realloc(responses, capacity * 2);
+            if (grown == NULL) {
+                break;
+            }
+            responses = grown;
+            capacity *= 2;
+        }
+    }
+    pthread_join(writerThread, NULL);
+    pthread_join(serveThread, NULL);
+    close(in[0]);
+    close(out[0]);
+    *status = run.status;
+    *responseLength = used;
+    return responses;
+}
+
+/* Test Server: pipelined requests through serveStream, on both batch paths */
+static void testServer(void) {
+    static const char *const patterns[] = {"(a|b)*abb", "x+y"};
+    static const char *const symbols[] = {"ab", "xy"};
+    char paths[2][32] = {"/tmp/automata_serveXXXXXX", "/tmp/automata_serveXXXXXX"};
+    char *argv[2], *requests, *responses, *expected, *longLine, detail[96];
+    FSM fsm[2];
+    CompiledFSM cfsm[2];
+    MatchServer server;
+    MatchResult match;
+    unsigned int seed = 5;
+    size_t used = 0, expectedUsed = 0, responseLength, i, j, length;
+    int a, fd, threads, status, ok = 1;
+
+    printf("=== Match server ===\n");
+    for (a = 0; a < 2; a++) {
+        fd = mkstemp(paths[a]);
+        if (fd >= 0) {
+            close(fd);
+        }
+        argv[a] = paths[a];
+        if (fd < 0 || compileRegexDFA(patterns[a], &fsm[a], &cfsm[a]) != 0 ||
+            saveCompiledFSM(&cfsm[a], paths[a]) != 0) {
+            check(0, "server setup", patterns[a]);
+            return;
+        }
+    }
+
+    /* Random requests for both automata, then every error kind; the request
+       too long for the read buffer is followed by a final line with no newline */
+    requests = malloc(TEST_SERVE_REQUESTS * 32 + SERVE_BUFFER + 64);
+    expected = malloc(TEST_SERVE_REQUESTS * 32 + 256);
+    if (requests == NULL || expected == NULL) {
+        check(0, "server setup", "out of memory");
+        free(requests);
+        free(expected);
+        return;
+    }
+    for (i = 0; i < TEST_SERVE_REQUESTS; i++) {
+        a = (int)(testRandom(&seed) % 2);
+        length = testRandom(&seed) % 12;
+        used += (size_t)sprintf(requests + used, "%d ", a);
+        for (j = 0; j < length; j++) {
+            requests[used + j] = symbols[a][testRandom(&seed) % 2];
+        }
+        match = matchCompiledFSM(&cfsm[a], requests + used, length);
+        used += length;
+        requests[used++] = i % 7 == 0 ? '\r' : '\n';
+        if (i % 7 == 0) {
+            requests[used++] = '\n';
+        }
+        if (match.failOffset >= 0) {
+            expectedUsed += (size_t)sprintf(expected + expectedUsed, "REJECT %ld\n",
+                                            match.failOffset);
+        } else {
+            expectedUsed += (size_t)sprintf(expected + expectedUsed, "%s\n",
+                                            match.accepted ? "ACCEPT" : "REJECT");
+        }
+    }
+    used += (size_t)sprintf(requests + used, "2 abb\n1abb\n\n99999999999 x\n");
+    expectedUsed += (size_t)sprintf(expected + expectedUsed, "ERROR unknown automaton\n"
+                                    "ERROR bad request\nERROR bad request\n"
+                                    "ERROR unknown automaton\n");
+    longLine = requests + used;
+    memset(longLine, 'a', SERVE_BUFFER + 8);
+    longLine[0] = '0';
+    longLine[1] = ' ';
+    used += SERVE_BUFFER + 8;
+    used += (size_t)sprintf(requests + used, "\n0 aabb");
+    expectedUsed += (size_t)sprintf(expected + expectedUsed, "ERROR request too long\nACCEPT\n");
+
+    for (threads = 1; threads >= 0; threads--) {
+        if (loadServer(&server, argv, 2, threads) != 0) {
+            check(0, "loadServer", "two automata");
+            break;
+        }
+        responses = runServe(&server, requests, used, &responseLength, &status);
+        for (i = 0, ok = responses != NULL && status == 0; ok && i < expectedUsed; i++) {
+            ok = i < responseLength && responses[i] == expected[i];
+        }
+        sprintf(detail, "%s batches: responses differ at byte %lu of %lu",
+                threads == 1 ? "interleaved" : "parallel", (unsigned long)i,
+                (unsigned long)responseLength);
+        check(ok && responseLength == expectedUsed, "serveStream", detail);
+        free(responses);
+        freeServer(&server);
+    }
+
+    for (a = 0; a < 2; a++) {
+        unlink(paths[a]);
+        freeCompiledFSM(&cfsm[a]);
+        freeFSM(&fsm[a]);
+    }
+    free(requests);
+    free(expected);
+}
+
+int main(void) {
+    double start = benchSeconds();
+
+    testRegexEngines();
+    testBatchEngines();
+    testEarlySettle();
+    testEmittedSource();
+    testResultCache();
+    testParallelChunks();
+    testMinimizeEmpty();
+    testRejections();
+    testServer();
+    printf("\n%d checks, %d failed in %.2f s\n", checkCount, failCount, benchSeconds() - start);
+    return failCount == 0 ? 0 : 1;
+}